@@ -0,0 +1,911 @@
+#ifndef __CBPARSE_H__
+#define __CBPARSE_H__
+
+/*
+ * Allocation-free views over a coreboot table image held in a caller
+ * provided buffer. Nothing here depends on the WDK, so the same code is
+ * used by the driver on mapped memory and by user-mode tools on captured
+ * table images.
+ *
+ * Every accessor is bounded by the size of the buffer it was given and
+ * returns NULL (or 0) rather than reading past it.
+ */
+
+#include <string.h>
+
+#include "cbtable.h"
+#include "public.h"
+
+#if defined(_MSC_VER)
+#define CB_INLINE static __inline
+#else
+#define CB_INLINE static inline
+#endif
+
+/* SSE2 is baseline on x64; elsewhere only if the compiler targets it */
+#if defined(_M_AMD64) || (defined(__SSE2__) && !defined(_MSC_VER))
+#define CB_HAVE_SSE2 1
+#include <emmintrin.h>
+#endif
+
+#define CB_STATIC_ASSERT(name, cond) typedef char cb_static_assert_##name[(cond) ? 1 : -1]
+
+/* Layouts fixed by coreboot, the views below rely on them */
+CB_STATIC_ASSERT(table_header, sizeof(struct coreboot_table_header) == 24);
+CB_STATIC_ASSERT(table_entry, sizeof(struct coreboot_table_entry) == 8);
+CB_STATIC_ASSERT(cbmem_ref, sizeof(struct lb_cbmem_ref) == 16);
+CB_STATIC_ASSERT(cbmem_entry, sizeof(struct lb_cbmem_entry) == 24);
+CB_STATIC_ASSERT(forward, sizeof(struct lb_forward) == 16);
+CB_STATIC_ASSERT(tsc_info, sizeof(struct lb_tsc_info) == 12);
+CB_STATIC_ASSERT(memory_range, sizeof(struct lb_memory_range) == 20);
+CB_STATIC_ASSERT(cmos_entries, sizeof(struct cmos_entries) == 56);
+CB_STATIC_ASSERT(cmos_enums, sizeof(struct cmos_enums) == 48);
+CB_STATIC_ASSERT(cbmem_console, sizeof(struct cbmem_console) == 8);
+CB_STATIC_ASSERT(timestamp_entry, sizeof(struct timestamp_entry) == 12);
+CB_STATIC_ASSERT(tcpa_entry, sizeof(struct tcpa_entry) == 132);
+CB_STATIC_ASSERT(tcpa_table, sizeof(struct tcpa_table) == 4);
+
+/*
+ * sum of the 16 bit words in size bytes, modulo 2^32. An odd last byte is
+ * not included. addr needs no alignment; the words are loaded with memcpy,
+ * which compiles to a plain load where unaligned loads are allowed.
+ */
+CB_INLINE UINT32 cb_sum_words(const void* addr, size_t size)
+{
+	const UINT8* p = (const UINT8*)addr;
+	size_t i, n = size / 2;
+	UINT32 sum = 0;
+
+	for (i = 0; i < n; i++) {
+		UINT16 word;
+
+		memcpy(&word, p + i * 2, sizeof(word));
+		sum += word;
+	}
+
+	return sum;
+}
+
+#if defined(CB_HAVE_SSE2)
+/*
+ * cb_sum_words with SSE2. Words are widened into 32 bit lanes that wrap
+ * exactly like the scalar sum, so the lanes add up to the same value.
+ * No XMM state needs saving for it in the Windows x64 kernel.
+ */
+CB_INLINE UINT32 cb_sum_words_sse2(const void* addr, size_t size)
+{
+	const UINT8* p = (const UINT8*)addr;
+	const __m128i zero = _mm_setzero_si128();
+	__m128i acc0 = _mm_setzero_si128();
+	__m128i acc1 = _mm_setzero_si128();
+	size_t i = 0, n = size / 2;
+
+	for (; i + 16 <= n; i += 16) {
+		__m128i a = _mm_loadu_si128((const __m128i*)(p + i * 2));
+		__m128i b = _mm_loadu_si128((const __m128i*)(p + i * 2 + 16));
+
+		acc0 = _mm_add_epi32(acc0, _mm_unpacklo_epi16(a, zero));
+		acc1 = _mm_add_epi32(acc1, _mm_unpackhi_epi16(a, zero));
+		acc0 = _mm_add_epi32(acc0, _mm_unpacklo_epi16(b, zero));
+		acc1 = _mm_add_epi32(acc1, _mm_unpackhi_epi16(b, zero));
+	}
+
+	acc0 = _mm_add_epi32(acc0, acc1);
+	acc0 = _mm_add_epi32(acc0, _mm_shuffle_epi32(acc0, _MM_SHUFFLE(1, 0, 3, 2)));
+	acc0 = _mm_add_epi32(acc0, _mm_shuffle_epi32(acc0, _MM_SHUFFLE(2, 3, 0, 1)));
+
+	return (UINT32)_mm_cvtsi128_si32(acc0) + cb_sum_words(p + i * 2, (n - i) * 2);
+}
+#endif
+
+/* ip checksum of a word sum as returned by cb_sum_words */
+CB_INLINE UINT16 cb_fold_checksum(UINT32 sum)
+{
+	sum = (sum >> 16) + (sum & 0xffff);
+	sum += (sum >> 16);
+	sum = ~sum & 0xffff;
+	return (UINT16)sum;
+}
+
+/*
+ * header of the table at buf if it has the LBIO signature and its
+ * entries fit in size bytes. The checksum is not verified.
+ */
+CB_INLINE struct coreboot_table_header* cb_table_header(void* buf, size_t size)
+{
+	struct coreboot_table_header* hdr = (struct coreboot_table_header*)buf;
+
+	if (!buf || size < sizeof(*hdr))
+		return NULL;
+
+	if (hdr->signature[0] != 'L' || hdr->signature[1] != 'B' ||
+		hdr->signature[2] != 'I' || hdr->signature[3] != 'O')
+		return NULL;
+
+	if (hdr->header_bytes < sizeof(*hdr) || hdr->header_bytes > size ||
+		hdr->table_bytes > size - hdr->header_bytes)
+		return NULL;
+
+	return hdr;
+}
+
+CB_INLINE int cb_table_checksum_ok(struct coreboot_table_header* hdr, UINT32 word_sum)
+{
+	return hdr->table_checksum == cb_fold_checksum(word_sum);
+}
+
+/* cb_table_header plus the table checksum */
+CB_INLINE struct coreboot_table_header* cb_table_valid(void* buf, size_t size)
+{
+	struct coreboot_table_header* hdr = cb_table_header(buf, size);
+
+	if (!hdr)
+		return NULL;
+
+	if (!cb_table_checksum_ok(hdr, cb_sum_words((UINT8*)hdr + hdr->header_bytes, hdr->table_bytes)))
+		return NULL;
+
+	return hdr;
+}
+
+/*
+ * Entry iterator:
+ *
+ *	struct cb_entry_iter it;
+ *	struct coreboot_table_entry* entry;
+ *
+ *	cb_for_each_entry(entry, it, hdr) {
+ *		...
+ *	}
+ *
+ * Iteration stops at table_entries, or early at an entry that is shorter
+ * than its own header or runs past table_bytes.
+ */
+struct cb_entry_iter {
+	UINT8* next;
+	UINT8* end;
+	UINT32 left;
+};
+
+CB_INLINE struct cb_entry_iter cb_entries(struct coreboot_table_header* hdr)
+{
+	struct cb_entry_iter it;
+
+	it.next = (UINT8*)hdr + hdr->header_bytes;
+	it.end = it.next + hdr->table_bytes;
+	it.left = hdr->table_entries;
+	return it;
+}
+
+CB_INLINE struct coreboot_table_entry* cb_entry_next(struct cb_entry_iter* it)
+{
+	struct coreboot_table_entry* entry = (struct coreboot_table_entry*)it->next;
+	size_t room = (size_t)(it->end - it->next);
+
+	if (!it->left || room < sizeof(*entry) ||
+		entry->size < sizeof(*entry) || entry->size > room)
+		return NULL;
+
+	it->next += entry->size;
+	it->left--;
+	return entry;
+}
+
+#define cb_for_each_entry(entry, it, hdr) \
+	for ((it) = cb_entries(hdr); ((entry) = cb_entry_next(&(it))) != NULL;)
+
+/*
+ * typed view of an entry, NULL if the entry is too short to hold the
+ * structure:
+ *
+ *	struct lb_cbmem_ref* ref = CB_ENTRY_VIEW(entry, struct lb_cbmem_ref);
+ */
+CB_INLINE void* cb_entry_view(struct coreboot_table_entry* entry, size_t min_size)
+{
+	if (!entry || entry->size < min_size)
+		return NULL;
+	return entry;
+}
+
+#define CB_ENTRY_VIEW(entry, type) ((type*)cb_entry_view((entry), sizeof(type)))
+
+/* first entry with the given tag, or NULL */
+CB_INLINE struct coreboot_table_entry* cb_find_entry(struct coreboot_table_header* hdr, UINT32 tag)
+{
+	struct cb_entry_iter it;
+	struct coreboot_table_entry* entry;
+
+	cb_for_each_entry(entry, it, hdr) {
+		if (entry->tag == tag)
+			return entry;
+	}
+
+	return NULL;
+}
+
+/*
+ * Region views. size is the number of bytes available at the region's
+ * address; counts are clamped to what fits in it.
+ */
+
+/* bytes of valid text in the console for a cursor value already read */
+CB_INLINE UINT32 cb_console_cursor_length(struct cbmem_console* console_p, UINT32 cursor, size_t size)
+{
+	UINT32 len;
+
+	if (size < sizeof(*console_p))
+		return 0;
+
+	len = console_p->size;
+
+	if (!(cursor & CBMC_OVERFLOW) && (cursor & CBMC_CURSOR_MASK) < len)
+		len = cursor & CBMC_CURSOR_MASK;
+
+	if (len > size - sizeof(*console_p))
+		len = (UINT32)(size - sizeof(*console_p));
+	return len;
+}
+
+/* bytes of valid text in the console, read from the live cursor */
+CB_INLINE UINT32 cb_console_length(struct cbmem_console* console_p, size_t size)
+{
+	if (size < sizeof(*console_p))
+		return 0;
+
+	return cb_console_cursor_length(console_p, *(volatile UINT32*)&console_p->cursor, size);
+}
+
+CB_INLINE UINT32 cb_timestamp_count(struct timestamp_table* timestamp_p, size_t size)
+{
+	size_t header = (size_t)((UINT8*)timestamp_p->entries - (UINT8*)timestamp_p);
+	UINT32 count;
+
+	if (size < header)
+		return 0;
+
+	count = timestamp_p->num_entries;
+	if (count > (size - header) / sizeof(timestamp_p->entries[0]))
+		count = (UINT32)((size - header) / sizeof(timestamp_p->entries[0]));
+	return count;
+}
+
+CB_INLINE UINT32 cb_tcpa_count(struct tcpa_table* tcpa_p, size_t size)
+{
+	UINT32 count;
+
+	if (size < sizeof(*tcpa_p))
+		return 0;
+
+	count = tcpa_p->num_entries;
+	if (count > (size - sizeof(*tcpa_p)) / sizeof(tcpa_p->entries[0]))
+		count = (UINT32)((size - sizeof(*tcpa_p)) / sizeof(tcpa_p->entries[0]));
+	return count;
+}
+
+/*
+ * Region reads. These are what IOCTL_CBTABLE_READ_REGION serves, written
+ * against a plain image so a reader of a captured table or of /dev/mem
+ * hands out the same bytes as the driver.
+ */
+
+/* bytes of a region in use, at most size */
+CB_INLINE size_t cb_region_length(UINT32 region, void* image, size_t size)
+{
+	size_t len;
+
+	switch (region) {
+	case NextRequestConsole: {
+		struct cbmem_console* console_p = (struct cbmem_console*)image;
+		if (size < sizeof(*console_p))
+			return 0;
+		len = sizeof(*console_p) + cb_console_length(console_p, size);
+		break;
+	}
+	case NextRequestTimestamps: {
+		struct timestamp_table* timestamp_p = (struct timestamp_table*)image;
+		len = offsetof(struct timestamp_table, entries) +
+			cb_timestamp_count(timestamp_p, size) * sizeof(timestamp_p->entries[0]);
+		break;
+	}
+	case NextRequestTcpa: {
+		struct tcpa_table* tcpa_p = (struct tcpa_table*)image;
+		len = sizeof(*tcpa_p) + cb_tcpa_count(tcpa_p, size) * sizeof(tcpa_p->entries[0]);
+		break;
+	}
+	default:
+		len = size;
+		break;
+	}
+
+	return len < size ? len : size;
+}
+
+/*
+ * console text as one linear buffer, oldest byte first. Once the console
+ * has wrapped the oldest text starts at the cursor.
+ */
+struct cb_console_text {
+	const UINT8* ring;
+	UINT32 size;		/* ring bytes available in the image */
+	UINT32 start;		/* ring position of text offset 0 */
+	UINT32 length;
+	UINT32 cursor;
+};
+
+CB_INLINE void cb_console_view(struct cbmem_console* console_p, size_t size, struct cb_console_text* text)
+{
+	UINT32 cursor;
+
+	text->ring = (const UINT8*)(console_p + 1);
+	text->size = 0;
+	text->start = 0;
+	text->length = 0;
+	text->cursor = 0;
+
+	if (size < sizeof(*console_p))
+		return;
+
+	cursor = *(volatile UINT32*)&console_p->cursor;
+	text->length = cb_console_cursor_length(console_p, cursor, size);
+	text->cursor = cursor;
+
+	text->size = console_p->size;
+	if (text->size > size - sizeof(*console_p))
+		text->size = (UINT32)(size - sizeof(*console_p));
+
+	if ((cursor & CBMC_OVERFLOW) && (cursor & CBMC_CURSOR_MASK) < text->size)
+		text->start = cursor & CBMC_CURSOR_MASK;
+}
+
+/* ring position of text offset, offset < length */
+CB_INLINE UINT32 cb_console_pos(const struct cb_console_text* text, UINT32 offset)
+{
+	UINT32 pos = text->start + offset;
+
+	return pos >= text->size ? pos - text->size : pos;
+}
+
+/*
+ * copies len bytes of the ring from position pos, wrapping back to the
+ * beginning at most once; len is at most size
+ */
+CB_INLINE void cb_console_copy_ring(const struct cb_console_text* text, UINT32 pos, UINT8* out, size_t len)
+{
+	size_t first = text->size - pos;
+
+	if (first > len)
+		first = len;
+
+	memcpy(out, text->ring + pos, first);
+	memcpy(out + first, text->ring, len - first);
+}
+
+/* copies len bytes of text from offset, offset + len <= length */
+CB_INLINE void cb_console_copy(const struct cb_console_text* text, UINT32 offset, UINT8* out, size_t len)
+{
+	if (len)
+		cb_console_copy_ring(text, cb_console_pos(text, offset), out, len);
+}
+
+/* name a CBTABLE_STAGE_* banner carries, NULL for the payload */
+CB_INLINE const char* cb_stage_name(UINT32 stage)
+{
+	switch (stage) {
+	case CBTABLE_STAGE_BOOTBLOCK:
+		return "bootblock";
+	case CBTABLE_STAGE_VERSTAGE:
+		return "verstage";
+	case CBTABLE_STAGE_ROMSTAGE:
+		return "romstage";
+	case CBTABLE_STAGE_POSTCAR:
+		return "postcar";
+	case CBTABLE_STAGE_RAMSTAGE:
+		return "ramstage";
+	default:
+		return NULL;
+	}
+}
+
+/* longest line prefix looked at when classifying a line */
+#define CB_BANNER_PREFIX 96
+
+/*
+ * CBTABLE_STAGE_* stage started by the console line of len bytes at
+ * offset, or 0. coreboot opens every stage with "coreboot-<version> ...
+ * <stage> starting", and ramstage ends with "Jumping to boot code at ..."
+ * right before the payload runs. Newer coreboot puts a log level marker
+ * byte in front of each line, which is skipped.
+ */
+CB_INLINE UINT32 cb_console_line_stage(const struct cb_console_text* text, UINT32 offset, UINT32 len)
+{
+	static const char banner[] = "coreboot-";
+	static const char payload[] = "Jumping to boot code";
+	static const char starting[] = " starting";
+	char line[CB_BANNER_PREFIX];
+	UINT32 stage, i;
+	UINT8 first;
+
+	if (!len)
+		return 0;
+
+	first = text->ring[cb_console_pos(text, offset)];
+	if (first >= CBMC_LOG_MARKER_FIRST && first <= CBMC_LOG_MARKER_LAST) {
+		offset++;
+		len--;
+	}
+
+	if (len < sizeof(banner) - 1)
+		return 0;
+
+	first = text->ring[cb_console_pos(text, offset)];
+	if (first != 'c' && first != 'J')
+		return 0;
+
+	if (len > sizeof(line))
+		len = sizeof(line);
+	cb_console_copy(text, offset, (UINT8*)line, len);
+
+	if (len >= sizeof(payload) - 1 && !memcmp(line, payload, sizeof(payload) - 1))
+		return CBTABLE_STAGE_PAYLOAD;
+
+	if (memcmp(line, banner, sizeof(banner) - 1))
+		return 0;
+
+	for (stage = 0; stage < CBTABLE_STAGE_COUNT; stage++) {
+		const char* name = cb_stage_name(stage);
+		size_t name_len;
+
+		if (!name)
+			continue;
+
+		name_len = strlen(name);
+		for (i = 0; i + name_len + sizeof(starting) - 1 <= len; i++) {
+			if (!memcmp(line + i, name, name_len) && !memcmp(line + i + name_len, starting, sizeof(starting) - 1))
+				return stage;
+		}
+	}
+
+	return 0;
+}
+
+/*
+ * copies up to len bytes of a region from offset and returns how many.
+ * The console reads as its header followed by its text in chronological
+ * order, so chunked reads of a wrapped console line up.
+ */
+CB_INLINE size_t cb_region_read(UINT32 region, void* image, size_t size, UINT64 offset, void* out, size_t len)
+{
+	struct cb_console_text text;
+	UINT8* p = (UINT8*)out;
+	size_t total, pos, copied;
+
+	if (region != NextRequestConsole) {
+		total = cb_region_length(region, image, size);
+		if (offset >= total)
+			return 0;
+		if (len > total - (size_t)offset)
+			len = total - (size_t)offset;
+		memcpy(p, (UINT8*)image + (size_t)offset, len);
+		return len;
+	}
+
+	if (size < sizeof(struct cbmem_console))
+		return 0;
+
+	/* one cursor read for the whole copy */
+	cb_console_view((struct cbmem_console*)image, size, &text);
+	total = sizeof(struct cbmem_console) + text.length;
+	if (offset >= total)
+		return 0;
+
+	pos = (size_t)offset;
+	if (len > total - pos)
+		len = total - pos;
+	copied = len;
+
+	if (pos < sizeof(struct cbmem_console)) {
+		size_t head = sizeof(struct cbmem_console) - pos;
+
+		if (head > len)
+			head = len;
+		memcpy(p, (UINT8*)image + pos, head);
+		p += head;
+		pos += head;
+		len -= head;
+	}
+
+	cb_console_copy(&text, (UINT32)(pos - sizeof(struct cbmem_console)), p, len);
+	return copied;
+}
+
+/*
+ * Memory map. cb_memory_build turns the LB_TAG_MEMORY entry into the
+ * sorted, non-overlapping ranges of IOCTL_CBTABLE_GET_MEMORY_MAP, which
+ * cb_memory_classify then searches.
+ */
+
+CB_INLINE UINT64 cb_uint64(struct lb_uint64 value)
+{
+	return ((UINT64)value.hi << 32) | value.lo;
+}
+
+CB_INLINE UINT32 cb_memory_range_count(struct lb_memory* mem)
+{
+	if (mem->size < sizeof(*mem))
+		return 0;
+	return (UINT32)((mem->size - sizeof(*mem)) / sizeof(mem->map[0]));
+}
+
+/*
+ * fills out, which must have room for cb_memory_range_count entries, and
+ * returns how many it used. Where ranges overlap the one starting first
+ * keeps the overlap; coreboot does not emit overlapping ranges, this only
+ * keeps the result searchable if a firmware does.
+ */
+CB_INLINE UINT32 cb_memory_build(struct lb_memory* mem, struct cbtable_memory_range* out)
+{
+	UINT32 count = cb_memory_range_count(mem);
+	UINT32 used = 0;
+	UINT32 i, j;
+
+	for (i = 0; i < count; i++) {
+		struct cbtable_memory_range range;
+		UINT64 size = cb_uint64(mem->map[i].size);
+
+		range.start = cb_uint64(mem->map[i].start);
+		range.end = range.start + size;
+		range.type = mem->map[i].type;
+		range.reserved = 0;
+
+		if (!size || range.end < range.start)
+			continue;
+
+		/* insertion sort, memory maps have a few dozen ranges at most */
+		for (j = used; j > 0 && out[j - 1].start > range.start; j--)
+			out[j] = out[j - 1];
+		out[j] = range;
+		used++;
+	}
+
+	count = used;
+	used = 0;
+
+	for (i = 0; i < count; i++) {
+		struct cbtable_memory_range range = out[i];
+
+		if (used) {
+			struct cbtable_memory_range* last = &out[used - 1];
+
+			if (range.start < last->end)
+				range.start = last->end;
+			if (range.start >= range.end)
+				continue;
+
+			if (range.start == last->end && range.type == last->type) {
+				last->end = range.end;
+				continue;
+			}
+		}
+
+		out[used++] = range;
+	}
+
+	return used;
+}
+
+/*
+ * range holding addr, or NULL if none does. The search narrows with a
+ * conditional move rather than a branch, so its cost does not depend on
+ * the address. cb_memory_classify gives its LB_MEM_* type, or 0.
+ */
+CB_INLINE const struct cbtable_memory_range* cb_memory_lookup(const struct cbtable_memory_range* ranges, UINT32 count, UINT64 addr)
+{
+	const struct cbtable_memory_range* base = ranges;
+	UINT32 n = count;
+
+	if (!n)
+		return NULL;
+
+	while (n > 1) {
+		UINT32 half = n / 2;
+		base = (base[half].start <= addr) ? base + half : base;
+		n -= half;
+	}
+
+	return (addr >= base->start && addr < base->end) ? base : NULL;
+}
+
+CB_INLINE UINT32 cb_memory_classify(const struct cbtable_memory_range* ranges, UINT32 count, UINT64 addr)
+{
+	const struct cbtable_memory_range* range = cb_memory_lookup(ranges, count, addr);
+
+	return range ? range->type : 0;
+}
+
+/*
+ * LB_MEM_* type of the range holding all of [addr, addr + bytes), or 0 if
+ * the span is empty, wraps or is not inside a single range. Adjacent
+ * ranges of one type are merged by cb_memory_build, so a span is never
+ * refused only for crossing between two of them.
+ */
+CB_INLINE UINT32 cb_memory_span_type(const struct cbtable_memory_range* ranges, UINT32 count, UINT64 addr, UINT64 bytes)
+{
+	const struct cbtable_memory_range* range;
+
+	if (!bytes || addr + bytes < addr)
+		return 0;
+
+	range = cb_memory_lookup(ranges, count, addr);
+	return (range && addr + bytes <= range->end) ? range->type : 0;
+}
+
+CB_INLINE void cb_memory_classify_batch(const struct cbtable_memory_range* ranges, UINT32 count,
+	const UINT64* addrs, UINT32* types, size_t n)
+{
+	size_t i;
+
+	for (i = 0; i < n; i++)
+		types[i] = cb_memory_classify(ranges, count, addrs[i]);
+}
+
+/*
+ * CMOS option table. Its LB_TAG_OPTION, LB_TAG_OPTION_ENUM and
+ * LB_TAG_OPTION_DEFAULTS records are nested inside the
+ * LB_TAG_CMOS_OPTION_TABLE entry rather than being table entries.
+ */
+
+/* iterator over the records of an option table, use with cb_entry_next */
+CB_INLINE struct cb_entry_iter cb_option_entries(struct cmos_option_table* table)
+{
+	struct cb_entry_iter it;
+
+	it.next = it.end = (UINT8*)table;
+	it.left = 0;
+
+	if (table->size < sizeof(*table) || table->header_length < sizeof(*table) ||
+		table->header_length > table->size)
+		return it;
+
+	it.next = (UINT8*)table + table->header_length;
+	it.end = (UINT8*)table + table->size;
+	it.left = 0xffffffff;
+	return it;
+}
+
+#define cb_for_each_option(entry, it, table) \
+	for ((it) = cb_option_entries(table); ((entry) = cb_entry_next(&(it))) != NULL;)
+
+/* compares names of up to CMOS_MAX_NAME_LENGTH bytes, NUL padded or not */
+CB_INLINE int cb_option_name_cmp(const UINT8* a, const UINT8* b)
+{
+	size_t i;
+
+	for (i = 0; i < CMOS_MAX_NAME_LENGTH; i++) {
+		if (a[i] != b[i])
+			return a[i] < b[i] ? -1 : 1;
+		if (!a[i])
+			break;
+	}
+	return 0;
+}
+
+CB_INLINE UINT32 cb_option_count(struct cmos_option_table* table)
+{
+	struct cb_entry_iter it;
+	struct coreboot_table_entry* entry;
+	UINT32 count = 0;
+
+	cb_for_each_option(entry, it, table) {
+		if (entry->tag == LB_TAG_OPTION && CB_ENTRY_VIEW(entry, struct cmos_entries))
+			count++;
+	}
+	return count;
+}
+
+/*
+ * fills index, which must have room for cb_option_count entries, with the
+ * options sorted by name and returns how many there are
+ */
+CB_INLINE UINT32 cb_option_index(struct cmos_option_table* table, struct cmos_entries** index)
+{
+	struct cb_entry_iter it;
+	struct coreboot_table_entry* entry;
+	UINT32 count = 0;
+	UINT32 j;
+
+	cb_for_each_option(entry, it, table) {
+		struct cmos_entries* option = CB_ENTRY_VIEW(entry, struct cmos_entries);
+
+		if (entry->tag != LB_TAG_OPTION || !option)
+			continue;
+
+		for (j = count; j > 0 && cb_option_name_cmp(index[j - 1]->name, option->name) > 0; j--)
+			index[j] = index[j - 1];
+		index[j] = option;
+		count++;
+	}
+	return count;
+}
+
+/* binary search of an index built by cb_option_index */
+CB_INLINE struct cmos_entries* cb_option_find(struct cmos_entries** index, UINT32 count, const UINT8* name)
+{
+	UINT32 lo = 0, hi = count;
+
+	while (lo < hi) {
+		UINT32 mid = lo + (hi - lo) / 2;
+		int cmp = cb_option_name_cmp(index[mid]->name, name);
+
+		if (!cmp)
+			return index[mid];
+		if (cmp < 0)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return NULL;
+}
+
+CB_INLINE struct cmos_enums* cb_option_enum(struct cmos_option_table* table, UINT32 config_id, UINT32 value)
+{
+	struct cb_entry_iter it;
+	struct coreboot_table_entry* entry;
+
+	cb_for_each_option(entry, it, table) {
+		struct cmos_enums* option_enum = CB_ENTRY_VIEW(entry, struct cmos_enums);
+
+		if (entry->tag == LB_TAG_OPTION_ENUM && option_enum &&
+			option_enum->config_id == config_id && option_enum->value == value)
+			return option_enum;
+	}
+	return NULL;
+}
+
+CB_INLINE struct cmos_defaults* cb_option_defaults(struct cmos_option_table* table)
+{
+	struct cb_entry_iter it;
+	struct coreboot_table_entry* entry;
+
+	cb_for_each_option(entry, it, table) {
+		if (entry->tag == LB_TAG_OPTION_DEFAULTS)
+			return CB_ENTRY_VIEW(entry, struct cmos_defaults);
+	}
+	return NULL;
+}
+
+/*
+ * the length bits of an option starting at its bit offset in a CMOS
+ * image, least significant bit first. 0 if the field is longer than 64
+ * bits or runs past the image.
+ */
+CB_INLINE int cb_option_value(const UINT8* image, size_t size, struct cmos_entries* option, UINT64* value)
+{
+	UINT32 i;
+
+	*value = 0;
+
+	if (!option->length || option->length > 64 ||
+		option->bit / 8 >= size || (option->bit + option->length - 1) / 8 >= size)
+		return 0;
+
+	for (i = 0; i < option->length; i++) {
+		UINT32 bit = option->bit + i;
+		*value |= (UINT64)((image[bit / 8] >> (bit % 8)) & 1) << i;
+	}
+	return 1;
+}
+
+/*
+ * TCPA log replay, as IOCTL_CBTABLE_REPLAY_PCRS returns it. Every PCR
+ * with log entries starts out zeroed and is extended with each digest
+ * logged for it, new = H(old || digest), once per hash bank. H comes
+ * from the caller, kernel CNG in the driver and any hash library on the
+ * host.
+ */
+
+/*
+ * replaces the len bytes at pcr with H(pcr || digest) for bank, a
+ * CBTABLE_PCR_* value. Returns 0, or a positive value that stops the
+ * replay and is returned from cb_tcpa_replay.
+ */
+typedef int (*cb_pcr_extend)(void* context, UINT32 bank, UINT8* pcr, const UINT8* digest, UINT32 len);
+
+#define CB_REPLAY_NO_ROOM (-1)
+
+/* digest length of a CBTABLE_PCR_* bank, 0 for an unknown one */
+CB_INLINE UINT32 cb_pcr_digest_length(UINT32 bank)
+{
+	switch (bank) {
+	case CBTABLE_PCR_SHA1:
+		return 20;
+	case CBTABLE_PCR_SHA256:
+		return 32;
+	default:
+		return 0;
+	}
+}
+
+/*
+ * bank an entry is extended into, picked by digest size since firmware
+ * does not spell digest_type consistently. -1 if it can't be replayed.
+ */
+CB_INLINE int cb_tcpa_entry_bank(const struct tcpa_entry* entry)
+{
+	UINT32 bank;
+
+	if (entry->pcr >= CBTABLE_PCR_COUNT)
+		return -1;
+
+	for (bank = 0; bank < CBTABLE_PCR_BANKS; bank++) {
+		if (entry->digest_length == cb_pcr_digest_length(bank))
+			return (int)bank;
+	}
+	return -1;
+}
+
+/*
+ * replays the first count entries of tcpa_p into out, which has room for
+ * room values ordered by bank, then PCR. out->count and out->skipped are
+ * always filled in. If the values don't all fit, CB_REPLAY_NO_ROOM is
+ * returned before anything is hashed. Each PCR's chain of extends runs
+ * back to back, one pass over the log per PCR.
+ */
+CB_INLINE int cb_tcpa_replay(const struct tcpa_table* tcpa_p, UINT32 count, struct cbtable_pcr_replay* out, size_t room,
+	cb_pcr_extend extend, void* context)
+{
+	UINT32 used[CBTABLE_PCR_BANKS] = { 0 };
+	UINT32 slot = 0;
+	UINT32 bank, pcr, i;
+	int result;
+
+	out->count = 0;
+	out->skipped = 0;
+
+	for (i = 0; i < count; i++) {
+		int entry_bank = cb_tcpa_entry_bank(&tcpa_p->entries[i]);
+
+		if (entry_bank < 0) {
+			out->skipped++;
+			continue;
+		}
+
+		if (!(used[entry_bank] & (1u << tcpa_p->entries[i].pcr))) {
+			used[entry_bank] |= 1u << tcpa_p->entries[i].pcr;
+			out->count++;
+		}
+	}
+
+	if (room < out->count)
+		return CB_REPLAY_NO_ROOM;
+
+	for (bank = 0; bank < CBTABLE_PCR_BANKS; bank++) {
+		for (pcr = 0; pcr < CBTABLE_PCR_COUNT; pcr++) {
+			struct cbtable_pcr_value* value;
+
+			if (!(used[bank] & (1u << pcr)))
+				continue;
+
+			value = &out->pcrs[slot++];
+			memset(value, 0, sizeof(*value));
+			value->pcr = pcr;
+			value->algorithm = bank;
+			value->digest_length = cb_pcr_digest_length(bank);
+
+			for (i = 0; i < count; i++) {
+				const struct tcpa_entry* entry = &tcpa_p->entries[i];
+
+				if (entry->pcr != pcr || cb_tcpa_entry_bank(entry) != (int)bank)
+					continue;
+
+				result = extend(context, bank, value->digest, entry->digest, value->digest_length);
+				if (result)
+					return result;
+				value->entries++;
+			}
+		}
+	}
+
+	return 0;
+}
+
+#endif /* __CBPARSE_H__ */
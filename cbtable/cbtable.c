@@ -1,9 +1,7 @@
 #include "driver.h"
+#include "cbtable.tmh"
 #include "stdint.h"
 
-static ULONG CBTableDebugLevel = 100;
-static ULONG CBTableDebugCatagories = DBG_INIT || DBG_PNP || DBG_IOCTL;
-
 NTSTATUS
 DriverEntry(
 __in PDRIVER_OBJECT  DriverObject,
@@ -14,10 +12,14 @@ __in PUNICODE_STRING RegistryPath
 	WDF_DRIVER_CONFIG      config;
 	WDF_OBJECT_ATTRIBUTES  attributes;
 
+	WPP_INIT_TRACING(DriverObject, RegistryPath);
+	CBTableStatsInit();
+
 	CBTablePrint(DEBUG_LEVEL_INFO, DBG_INIT,
 		"Driver Entry\n");
 
 	WDF_DRIVER_CONFIG_INIT(&config, CBTableEvtDeviceAdd);
+	config.EvtDriverUnload = CBTableDriverUnload;
 
 	WDF_OBJECT_ATTRIBUTES_INIT(&attributes);
 
@@ -36,11 +38,33 @@ __in PUNICODE_STRING RegistryPath
 	{
 		CBTablePrint(DEBUG_LEVEL_ERROR, DBG_INIT,
 			"WdfDriverCreate failed with status 0x%x\n", status);
+
+		WPP_CLEANUP(DriverObject);
+		return status;
 	}
 
+	CBTableViewsInit();
 	return status;
 }
 
+VOID
+CBTableDriverUnload(
+	_In_  WDFDRIVER  Driver
+)
+/*++
+  Routine Description:
+	Stops process notifications and tracing once the driver is being
+	unloaded.
+  Arguments:
+	Driver - Handle to the framework driver object.
+  Return Value:
+	None.
+--*/
+{
+	CBTableViewsUnload();
+	WPP_CLEANUP(WdfDriverWdmGetDriverObject(Driver));
+}
+
 NTSTATUS
 OnPrepareHardware(
 _In_  WDFDEVICE     FxDevice,
@@ -101,14 +125,9 @@ Status
 		}
 	}
 
-	if (!NT_SUCCESS(status))
-		return status;
-
-	pDevice->rootMapping.virtAddr = MmMapIoSpace(pDevice->rootMapping.physAddr, pDevice->rootMapping.sz, MmCached);
-	if (!pDevice->rootMapping.virtAddr)
-		return STATUS_NO_MEMORY;
-
-	pDevice->rootMapping.mapped = TRUE;
+	//
+	// The table itself is only mapped once a client asks for it.
+	//
 
 	return status;
 }
@@ -139,13 +158,358 @@ Status
 	PCBTABLE_CONTEXT pDevice = GetDeviceContext(FxDevice);
 	UNREFERENCED_PARAMETER(FxResourcesTranslated);
 
-	if (pDevice->rootMapping.virtAddr) {
-		MmUnmapIoSpace(pDevice->rootMapping.virtAddr, pDevice->rootMapping.sz);
+	WdfTimerStop(pDevice->waitTimer, TRUE);
+	InterlockedExchange(&pDevice->waitArmed, 0);
+	WdfTimerStop(pDevice->idleTimer, TRUE);
+
+	CBTableReleaseAll(pDevice);
+
+	return status;
+}
+
+static NTSTATUS listCbmem(PCBTABLE_CONTEXT pDevice, PVOID Buffer, size_t BufLen, size_t *BytesCopied) {
+	struct cbtable_cbmem_directory* directory = Buffer;
+	NTSTATUS status;
+
+	*BytesCopied = 0;
+
+	if (BufLen < sizeof(*directory))
+		return STATUS_BUFFER_TOO_SMALL;
+
+	status = CBTableAcquire(pDevice);
+	if (!NT_SUCCESS(status))
+		return status;
+
+	UINT32 count = pDevice->tagIndex[LB_TAG_CBMEM_ENTRY].count;
+
+	directory->count = count;
+	directory->reserved = 0;
+
+	UINT32 fit = (UINT32)min(count, (BufLen - sizeof(*directory)) / sizeof(directory->entries[0]));
+	for (UINT32 i = 0; i < fit; i++) {
+		struct lb_cbmem_entry* entry = CB_ENTRY_VIEW(CBTableGetEntry(pDevice, LB_TAG_CBMEM_ENTRY, i), struct lb_cbmem_entry);
+		if (!entry) {
+			RtlZeroMemory(&directory->entries[i], sizeof(directory->entries[i]));
+			continue;
+		}
+
+		directory->entries[i].id = entry->id;
+		directory->entries[i].size = entry->entry_size;
+		directory->entries[i].address = entry->address;
 	}
 
+	CBTableRelease(pDevice);
+
+	*BytesCopied = sizeof(*directory) + fit * sizeof(directory->entries[0]);
+	return STATUS_SUCCESS;
+}
+
+static NTSTATUS copyMemoryMap(PCBTABLE_CONTEXT pDevice, PVOID Buffer, size_t BufLen, size_t *BytesCopied) {
+	struct cbtable_memory_map* map = Buffer;
+	NTSTATUS status;
+
+	*BytesCopied = 0;
+
+	status = CBTableAcquire(pDevice);
+	if (!NT_SUCCESS(status))
+		return status;
+
+	map->count = pDevice->memoryRangeCount;
+	map->reserved = 0;
+	*BytesCopied = sizeof(*map);
+
+	if ((BufLen - sizeof(*map)) / sizeof(map->ranges[0]) < map->count) {
+		status = STATUS_BUFFER_OVERFLOW;
+	}
+	else {
+		RtlCopyMemory(map->ranges, pDevice->memoryRanges, map->count * sizeof(map->ranges[0]));
+		*BytesCopied += map->count * sizeof(map->ranges[0]);
+	}
+
+	CBTableRelease(pDevice);
 	return status;
 }
 
+static NTSTATUS classifyAddresses(PCBTABLE_CONTEXT pDevice, UINT64* addrs, size_t count, UINT32* types, size_t *BytesCopied) {
+	NTSTATUS status;
+
+	*BytesCopied = 0;
+
+	status = CBTableAcquire(pDevice);
+	if (!NT_SUCCESS(status))
+		return status;
+
+	cb_memory_classify_batch(pDevice->memoryRanges, pDevice->memoryRangeCount, addrs, types, count);
+	*BytesCopied = count * sizeof(types[0]);
+
+	CBTableRelease(pDevice);
+	return STATUS_SUCCESS;
+}
+
+static NTSTATUS copyEntry(PCBTABLE_CONTEXT pDevice, struct cbtable_entry_request* request, PVOID Buffer, size_t BufLen, size_t *BytesCopied) {
+	NTSTATUS status;
+
+	*BytesCopied = 0;
+
+	status = CBTableAcquire(pDevice);
+	if (!NT_SUCCESS(status))
+		return status;
+
+	struct coreboot_table_entry* entry = CBTableGetEntry(pDevice, request->tag, request->instance);
+	if (!entry) {
+		status = STATUS_NOT_FOUND;
+	}
+	else {
+		*BytesCopied = min(BufLen, entry->size);
+		RtlCopyMemory(Buffer, entry, *BytesCopied);
+	}
+
+	CBTableRelease(pDevice);
+	return status;
+}
+
+static NTSTATUS copyCbmem(PCBTABLE_CONTEXT pDevice, UINT32 id, PVOID Buffer, size_t BufLen, size_t *BytesCopied) {
+	UINT64 start = CBTableStatsStart();
+	MemMapping* mapping;
+	NTSTATUS status;
+
+	*BytesCopied = 0;
+
+	status = CBTableAcquireCbmem(pDevice, id, &mapping);
+	if (!NT_SUCCESS(status))
+		return status;
+
+	*BytesCopied = min(BufLen, mapping->sz);
+	RtlCopyMemory(Buffer, mapping->virtAddr, *BytesCopied);
+
+	CBTableRelease(pDevice);
+	CBTableStatsRead(pDevice, CBTABLE_STATS_CBMEM, *BytesCopied, start);
+	return STATUS_SUCCESS;
+}
+
+/*
+ * copies BufLen bytes of a region starting at offset. The console is seen
+ * as its header followed by its text in chronological order, so chunked
+ * reads of a wrapped console line up.
+ */
+static NTSTATUS copyRegion(PCBTABLE_CONTEXT pDevice, enum NextRequest request, UINT64 offset, PVOID Buffer, size_t BufLen, size_t *BytesCopied) {
+	UINT64 started = CBTableStatsStart();
+	MemMapping* mapping;
+	NTSTATUS status;
+
+	*BytesCopied = 0;
+
+	status = CBTableAcquireRegion(pDevice, request, &mapping);
+	if (!NT_SUCCESS(status))
+		return status;
+
+	*BytesCopied = cb_region_read(request, mapping->virtAddr, mapping->sz, offset, Buffer, BufLen);
+
+	CBTableRelease(pDevice);
+	CBTableStatsRead(pDevice, request, *BytesCopied, started);
+
+	//
+	// Callers size their buffers generously; only clear what the copy
+	// did not cover rather than the whole buffer up front.
+	//
+	RtlZeroMemory((UINT8*)Buffer + *BytesCopied, BufLen - *BytesCopied);
+	return STATUS_SUCCESS;
+}
+
+/*
+ * size, location and entry count of every region, so callers can allocate
+ * exactly before reading
+ */
+static NTSTATUS queryRegions(PCBTABLE_CONTEXT pDevice, PVOID Buffer, size_t BufLen, size_t *BytesCopied) {
+	struct cbtable_regions* regions = Buffer;
+	size_t len = sizeof(*regions) + NextRequestReserved * sizeof(regions->regions[0]);
+	NTSTATUS status;
+
+	*BytesCopied = 0;
+
+	if (BufLen < len)
+		return STATUS_BUFFER_TOO_SMALL;
+
+	RtlZeroMemory(regions, len);
+	regions->count = NextRequestReserved;
+
+	//
+	// Regions are described from their headers, querying maps nothing
+	//
+	for (UINT32 request = 0; request < NextRequestReserved; request++) {
+		struct cbtable_region_info* info = &regions->regions[request];
+
+		info->region = request;
+
+		status = CBTableQueryRegion(pDevice, request, info);
+		if (status == STATUS_DEVICE_NOT_READY)
+			continue;
+		if (!NT_SUCCESS(status))
+			return status;
+	}
+
+	*BytesCopied = len;
+	return STATUS_SUCCESS;
+}
+
+/*
+ * regions a snapshot captures, in index order
+ */
+static const UINT32 snapshotRegions[] = {
+	NextRequestConsole,
+	NextRequestTimestamps,
+	NextRequestRoot,
+	CBTABLE_SNAPSHOT_FORWARD,
+	NextRequestTcpa,
+};
+
+/*
+ * one image of the root table, the table it forwards to and every region
+ * present in them, each payload starting on a CBTABLE_SNAPSHOT_ALIGN
+ * boundary
+ */
+static NTSTATUS copySnapshot(PCBTABLE_CONTEXT pDevice, PVOID Buffer, size_t BufLen, size_t *BytesCopied) {
+	struct cbtable_snapshot_header* hdr = Buffer;
+	size_t indexLen = sizeof(*hdr) + sizeof(snapshotRegions) / sizeof(snapshotRegions[0]) * sizeof(hdr->regions[0]);
+	UINT64 offset = ALIGN_UP_BY(indexLen, CBTABLE_SNAPSHOT_ALIGN);
+	UINT64 filled = indexLen;
+	NTSTATUS status;
+
+	*BytesCopied = 0;
+
+	if (BufLen < indexLen)
+		return STATUS_BUFFER_TOO_SMALL;
+
+	RtlZeroMemory(hdr, indexLen);
+	RtlCopyMemory(hdr->signature, "CBSN", sizeof(hdr->signature));
+	hdr->version = CBTABLE_SNAPSHOT_VERSION;
+
+	//
+	// One hold of the lock for the whole image, so the idle timer cannot
+	// unmap and a later request reparse the table between two regions
+	//
+	status = CBTableAcquireAllRegions(pDevice);
+	if (!NT_SUCCESS(status))
+		return status;
+
+	for (UINT32 i = 0; i < sizeof(snapshotRegions) / sizeof(snapshotRegions[0]); i++) {
+		struct cbtable_snapshot_region* region = &hdr->regions[hdr->region_count];
+		UINT32 request = snapshotRegions[i];
+		MemMapping* mapping = CBTableGetRegion(pDevice, request);
+		size_t len;
+
+		if (!mapping)
+			continue;	/* not in this table */
+
+		len = cb_region_length(request == CBTABLE_SNAPSHOT_FORWARD ? NextRequestRoot : request, mapping->virtAddr, mapping->sz);
+
+		if (offset + len <= BufLen) {
+			RtlZeroMemory((UINT8*)Buffer + filled, (size_t)(offset - filled));
+			RtlCopyMemory((UINT8*)Buffer + offset, mapping->virtAddr, len);
+			filled = offset + len;
+		}
+
+		region->region = request;
+		region->address = mapping->physAddr.QuadPart;
+		region->offset = offset;
+		region->bytes = len;
+
+		hdr->region_count++;
+		hdr->total_bytes = offset + len;
+		offset = ALIGN_UP_BY(offset + len, CBTABLE_SNAPSHOT_ALIGN);
+	}
+
+	CBTableRelease(pDevice);
+
+	hdr->header_bytes = (UINT32)(sizeof(*hdr) + hdr->region_count * sizeof(hdr->regions[0]));
+
+	if (hdr->total_bytes > BufLen) {
+		*BytesCopied = hdr->header_bytes;
+		return STATUS_BUFFER_OVERFLOW;
+	}
+
+	*BytesCopied = (size_t)hdr->total_bytes;
+	return STATUS_SUCCESS;
+}
+
+static NTSTATUS copyConsoleTail(PCBTABLE_CONTEXT pDevice, UINT32 lastCursor, PVOID Buffer, size_t BufLen, size_t *BytesCopied) {
+	UINT64 started = CBTableStatsStart();
+	MemMapping* mapping;
+	struct cbtable_console_tail* tail = Buffer;
+	NTSTATUS status;
+
+	*BytesCopied = 0;
+
+	if (BufLen < sizeof(*tail))
+		return STATUS_BUFFER_TOO_SMALL;
+
+	status = CBTableAcquireRegion(pDevice, NextRequestConsole, &mapping);
+	if (!NT_SUCCESS(status))
+		return status;
+
+	struct cb_console_text text;
+	cb_console_view(mapping->virtAddr, mapping->sz, &text);
+
+	UINT32 cursor = text.cursor;
+	UINT32 size = text.size;
+
+	tail->cursor = cursor;
+	tail->flags = 0;
+	tail->length = 0;
+	tail->reserved = 0;
+
+	if (cursor == lastCursor) {
+		*BytesCopied = sizeof(*tail);
+		goto exit;
+	}
+
+	UINT32 start = lastCursor & CBMC_CURSOR_MASK;
+	UINT32 end = cursor & CBMC_CURSOR_MASK;
+	UINT32 avail;
+
+	if (!(cursor & CBMC_OVERFLOW)) {
+		end = min(end, size);
+		if ((lastCursor & CBMC_OVERFLOW) || start > end) {
+			tail->flags = CBTABLE_CONSOLE_TAIL_RESET;
+			start = 0;
+		}
+		avail = end - start;
+	}
+	else if (end >= size) {
+		tail->flags = CBTABLE_CONSOLE_TAIL_RESET;
+		*BytesCopied = sizeof(*tail);
+		goto exit;
+	}
+	else if (start >= size || (!(lastCursor & CBMC_OVERFLOW) && (lastCursor == 0 || start <= end))) {
+		//
+		// The ring wrapped since lastCursor and has overwritten it (or this
+		// is the first call). Return the whole ring, oldest text first.
+		//
+		tail->flags = CBTABLE_CONSOLE_TAIL_RESET;
+		start = end;
+		avail = size;
+	}
+	else {
+		avail = (end + size - start) % size;
+	}
+
+	size_t len = min(avail, BufLen - sizeof(*tail));
+	if (len)
+		cb_console_copy_ring(&text, start, (UINT8*)(tail + 1), len);
+
+	if (cursor & CBMC_OVERFLOW)
+		tail->cursor = ((start + (UINT32)len) % size) | CBMC_OVERFLOW;
+	else
+		tail->cursor = start + (UINT32)len;
+	tail->length = (UINT32)len;
+	*BytesCopied = sizeof(*tail) + len;
+
+exit:
+	CBTableRelease(pDevice);
+	CBTableStatsRead(pDevice, NextRequestConsole, *BytesCopied, started);
+	return STATUS_SUCCESS;
+}
+
 VOID
 OnIoRead(
 	_In_  WDFQUEUE    FxQueue,
@@ -163,45 +527,339 @@ OnIoRead(
 
 	PVOID Buffer;
 	size_t BufLen;
+	size_t BytesCopied;
+
+	WDFFILEOBJECT fileObject = WdfRequestGetFileObject(FxRequest);
+	if (!fileObject) {
+		status = STATUS_INVALID_DEVICE_REQUEST;
+		goto exit;
+	}
+
+	PCBTABLE_FILE_CONTEXT pFile = GetFileContext(fileObject);
 
 	status = WdfRequestRetrieveOutputBuffer(FxRequest, Length, &Buffer, &BufLen);
 	if (!NT_SUCCESS(status)) {
-		DbgPrint("Failed to get output buffer\n");
+		CBTablePrint(DEBUG_LEVEL_ERROR, DBG_IOCTL, "Failed to get output buffer\n");
 		goto exit;
 	}
 
-	RtlZeroMemory(Buffer, BufLen);
+	status = copyRegion(pDevice, pFile->nextRequest, 0, Buffer, BufLen, &BytesCopied);
+	if (NT_SUCCESS(status)) {
+		WdfRequestSetInformation(FxRequest, BytesCopied);
+	}
 
-	MemMapping* mapping;
-	switch (pDevice->nextRequest) {
-	case NextRequestRoot:
-		mapping = &pDevice->rootMapping;
+	pFile->nextRequest = NextRequestConsole;
+
+exit:
+	WdfRequestComplete(FxRequest, status);
+}
+
+VOID
+OnIoDeviceControl(
+	_In_  WDFQUEUE    FxQueue,
+	_In_  WDFREQUEST  FxRequest,
+	_In_  size_t      OutputBufferLength,
+	_In_  size_t      InputBufferLength,
+	_In_  ULONG       IoControlCode
+)
+/*++
+  Routine Description:
+	Handles the single round-trip region interface. The region to read is
+	taken from the input buffer, so no per-device selection state is used.
+  Arguments:
+	FxQueue - Handle to the framework queue object that is associated with the
+		I/O request.
+	FxRequest - Handle to a framework request object.
+	OutputBufferLength - Length of the output buffer.
+	InputBufferLength - Length of the input buffer.
+	IoControlCode - The IOCTL code.
+  Return Value:
+	None.
+--*/
+{
+	WDFDEVICE device;
+	PCBTABLE_CONTEXT pDevice;
+
+	device = WdfIoQueueGetDevice(FxQueue);
+	pDevice = GetDeviceContext(device);
+
+	NTSTATUS status;
+
+	UINT32 region;
+	struct cbtable_region_read* regionRead;
+	PVOID InBuffer;
+	PVOID Buffer;
+	size_t BufLen;
+	size_t BytesCopied;
+
+	switch (IoControlCode) {
+	case IOCTL_CBTABLE_READ_REGION:
+		status = WdfRequestRetrieveInputBuffer(FxRequest, sizeof(UINT32), &InBuffer, NULL);
+		if (!NT_SUCCESS(status)) {
+			CBTablePrint(DEBUG_LEVEL_ERROR, DBG_IOCTL, "Failed to get input buffer\n");
+			break;
+		}
+
+		region = ((UINT32*)InBuffer)[0];
+		if (region >= NextRequestReserved) {
+			status = STATUS_INVALID_PARAMETER;
+			break;
+		}
+
+		status = WdfRequestRetrieveOutputBuffer(FxRequest, OutputBufferLength, &Buffer, &BufLen);
+		if (!NT_SUCCESS(status)) {
+			CBTablePrint(DEBUG_LEVEL_ERROR, DBG_IOCTL, "Failed to get output buffer\n");
+			break;
+		}
+
+		status = copyRegion(pDevice, (enum NextRequest)region, 0, Buffer, BufLen, &BytesCopied);
+		if (NT_SUCCESS(status)) {
+			WdfRequestSetInformation(FxRequest, BytesCopied);
+		}
 		break;
-	case NextRequestTcpa:
-		mapping = &pDevice->tcpaMapping;
+	case IOCTL_CBTABLE_READ_REGION_AT:
+		status = WdfRequestRetrieveInputBuffer(FxRequest, sizeof(struct cbtable_region_read), &InBuffer, NULL);
+		if (!NT_SUCCESS(status)) {
+			CBTablePrint(DEBUG_LEVEL_ERROR, DBG_IOCTL, "Failed to get input buffer\n");
+			break;
+		}
+
+		regionRead = InBuffer;
+		if (regionRead->region >= NextRequestReserved) {
+			status = STATUS_INVALID_PARAMETER;
+			break;
+		}
+
+		status = WdfRequestRetrieveOutputBuffer(FxRequest, OutputBufferLength, &Buffer, &BufLen);
+		if (!NT_SUCCESS(status)) {
+			CBTablePrint(DEBUG_LEVEL_ERROR, DBG_IOCTL, "Failed to get output buffer\n");
+			break;
+		}
+
+		status = copyRegion(pDevice, (enum NextRequest)regionRead->region, regionRead->offset, Buffer, BufLen, &BytesCopied);
+		if (NT_SUCCESS(status)) {
+			WdfRequestSetInformation(FxRequest, BytesCopied);
+		}
+		break;
+	case IOCTL_CBTABLE_READ_CONSOLE_TAIL:
+		status = WdfRequestRetrieveInputBuffer(FxRequest, sizeof(struct cbtable_console_tail_request), &InBuffer, NULL);
+		if (!NT_SUCCESS(status)) {
+			CBTablePrint(DEBUG_LEVEL_ERROR, DBG_IOCTL, "Failed to get input buffer\n");
+			break;
+		}
+
+		status = WdfRequestRetrieveOutputBuffer(FxRequest, sizeof(struct cbtable_console_tail), &Buffer, &BufLen);
+		if (!NT_SUCCESS(status)) {
+			CBTablePrint(DEBUG_LEVEL_ERROR, DBG_IOCTL, "Failed to get output buffer\n");
+			break;
+		}
+
+		status = copyConsoleTail(pDevice, ((struct cbtable_console_tail_request*)InBuffer)->cursor, Buffer, BufLen, &BytesCopied);
+		if (NT_SUCCESS(status)) {
+			WdfRequestSetInformation(FxRequest, BytesCopied);
+		}
 		break;
-	case NextRequestTimestamps:
-		mapping = &pDevice->timestampMapping;
+	case IOCTL_CBTABLE_GET_ENTRY:
+		status = WdfRequestRetrieveInputBuffer(FxRequest, sizeof(struct cbtable_entry_request), &InBuffer, NULL);
+		if (!NT_SUCCESS(status)) {
+			CBTablePrint(DEBUG_LEVEL_ERROR, DBG_IOCTL, "Failed to get input buffer\n");
+			break;
+		}
+
+		status = WdfRequestRetrieveOutputBuffer(FxRequest, OutputBufferLength, &Buffer, &BufLen);
+		if (!NT_SUCCESS(status)) {
+			CBTablePrint(DEBUG_LEVEL_ERROR, DBG_IOCTL, "Failed to get output buffer\n");
+			break;
+		}
+
+		status = copyEntry(pDevice, InBuffer, Buffer, BufLen, &BytesCopied);
+		if (NT_SUCCESS(status)) {
+			WdfRequestSetInformation(FxRequest, BytesCopied);
+		}
 		break;
-	case NextRequestConsole:
-	default:
-		mapping = &pDevice->consoleMapping;
+	case IOCTL_CBTABLE_LIST_CBMEM:
+		status = WdfRequestRetrieveOutputBuffer(FxRequest, sizeof(struct cbtable_cbmem_directory), &Buffer, &BufLen);
+		if (!NT_SUCCESS(status)) {
+			CBTablePrint(DEBUG_LEVEL_ERROR, DBG_IOCTL, "Failed to get output buffer\n");
+			break;
+		}
+
+		status = listCbmem(pDevice, Buffer, BufLen, &BytesCopied);
+		if (NT_SUCCESS(status)) {
+			WdfRequestSetInformation(FxRequest, BytesCopied);
+		}
 		break;
-	}	
+	case IOCTL_CBTABLE_READ_CBMEM:
+		status = WdfRequestRetrieveInputBuffer(FxRequest, sizeof(UINT32), &InBuffer, NULL);
+		if (!NT_SUCCESS(status)) {
+			CBTablePrint(DEBUG_LEVEL_ERROR, DBG_IOCTL, "Failed to get input buffer\n");
+			break;
+		}
 
-	if (!mapping->mapped) {
-		status = STATUS_DEVICE_NOT_READY;
-		DbgPrint("Requested mapping not present\n");
-	}
-	else {
-		RtlCopyMemory(Buffer, mapping->virtAddr, min(BufLen, mapping->sz));
+		status = WdfRequestRetrieveOutputBuffer(FxRequest, OutputBufferLength, &Buffer, &BufLen);
+		if (!NT_SUCCESS(status)) {
+			CBTablePrint(DEBUG_LEVEL_ERROR, DBG_IOCTL, "Failed to get output buffer\n");
+			break;
+		}
 
-		WdfRequestSetInformation(FxRequest, min(BufLen, mapping->sz));
-	}
+		status = copyCbmem(pDevice, ((UINT32*)InBuffer)[0], Buffer, BufLen, &BytesCopied);
+		if (NT_SUCCESS(status)) {
+			WdfRequestSetInformation(FxRequest, BytesCopied);
+		}
+		break;
+	case IOCTL_CBTABLE_READ_TIMESTAMPS_DECODED:
+		status = WdfRequestRetrieveOutputBuffer(FxRequest, sizeof(struct cbtable_timestamps), &Buffer, &BufLen);
+		if (!NT_SUCCESS(status)) {
+			CBTablePrint(DEBUG_LEVEL_ERROR, DBG_IOCTL, "Failed to get output buffer\n");
+			break;
+		}
 
-	pDevice->nextRequest = NextRequestConsole;
+		status = CBTableDecodeTimestamps(pDevice, Buffer, BufLen, &BytesCopied);
+		if (NT_SUCCESS(status) || status == STATUS_BUFFER_OVERFLOW) {
+			WdfRequestSetInformation(FxRequest, BytesCopied);
+		}
+		break;
+	case IOCTL_CBTABLE_SNAPSHOT:
+		status = WdfRequestRetrieveOutputBuffer(FxRequest, sizeof(struct cbtable_snapshot_header), &Buffer, &BufLen);
+		if (!NT_SUCCESS(status)) {
+			CBTablePrint(DEBUG_LEVEL_ERROR, DBG_IOCTL, "Failed to get output buffer\n");
+			break;
+		}
+
+		status = copySnapshot(pDevice, Buffer, BufLen, &BytesCopied);
+		if (NT_SUCCESS(status) || status == STATUS_BUFFER_OVERFLOW) {
+			WdfRequestSetInformation(FxRequest, BytesCopied);
+		}
+		break;
+	case IOCTL_CBTABLE_WAIT_CHANGE:
+		status = WdfRequestRetrieveInputBuffer(FxRequest, sizeof(struct cbtable_wait_state), &InBuffer, NULL);
+		if (!NT_SUCCESS(status)) {
+			CBTablePrint(DEBUG_LEVEL_ERROR, DBG_IOCTL, "Failed to get input buffer\n");
+			break;
+		}
+
+		status = WdfRequestRetrieveOutputBuffer(FxRequest, sizeof(struct cbtable_wait_state), &Buffer, &BufLen);
+		if (!NT_SUCCESS(status)) {
+			CBTablePrint(DEBUG_LEVEL_ERROR, DBG_IOCTL, "Failed to get output buffer\n");
+			break;
+		}
+
+		status = CBTableWaitForChange(pDevice, FxRequest, InBuffer);
+		if (status == STATUS_PENDING)
+			return;
+		break;
+	case IOCTL_CBTABLE_QUERY_REGIONS:
+		status = WdfRequestRetrieveOutputBuffer(FxRequest, sizeof(struct cbtable_regions), &Buffer, &BufLen);
+		if (!NT_SUCCESS(status)) {
+			CBTablePrint(DEBUG_LEVEL_ERROR, DBG_IOCTL, "Failed to get output buffer\n");
+			break;
+		}
+
+		status = queryRegions(pDevice, Buffer, BufLen, &BytesCopied);
+		if (NT_SUCCESS(status)) {
+			WdfRequestSetInformation(FxRequest, BytesCopied);
+		}
+		break;
+	case IOCTL_CBTABLE_REPLAY_PCRS:
+		if (InputBufferLength) {
+			status = STATUS_INVALID_PARAMETER;
+			break;
+		}
+
+		status = WdfRequestRetrieveOutputBuffer(FxRequest, sizeof(struct cbtable_pcr_replay), &Buffer, &BufLen);
+		if (!NT_SUCCESS(status)) {
+			CBTablePrint(DEBUG_LEVEL_ERROR, DBG_IOCTL, "Failed to get output buffer\n");
+			break;
+		}
+
+		status = CBTableReplayPcrs(pDevice, Buffer, BufLen, &BytesCopied);
+		if (NT_SUCCESS(status) || status == STATUS_BUFFER_OVERFLOW) {
+			WdfRequestSetInformation(FxRequest, BytesCopied);
+		}
+		break;
+	case IOCTL_CBTABLE_GET_MEMORY_MAP:
+		status = WdfRequestRetrieveOutputBuffer(FxRequest, sizeof(struct cbtable_memory_map), &Buffer, &BufLen);
+		if (!NT_SUCCESS(status)) {
+			CBTablePrint(DEBUG_LEVEL_ERROR, DBG_IOCTL, "Failed to get output buffer\n");
+			break;
+		}
+
+		status = copyMemoryMap(pDevice, Buffer, BufLen, &BytesCopied);
+		if (NT_SUCCESS(status) || status == STATUS_BUFFER_OVERFLOW) {
+			WdfRequestSetInformation(FxRequest, BytesCopied);
+		}
+		break;
+	case IOCTL_CBTABLE_CLASSIFY_ADDRESSES:
+		status = WdfRequestRetrieveInputBuffer(FxRequest, sizeof(UINT64), &InBuffer, NULL);
+		if (!NT_SUCCESS(status)) {
+			CBTablePrint(DEBUG_LEVEL_ERROR, DBG_IOCTL, "Failed to get input buffer\n");
+			break;
+		}
+
+		status = WdfRequestRetrieveOutputBuffer(FxRequest, (InputBufferLength / sizeof(UINT64)) * sizeof(UINT32), &Buffer, &BufLen);
+		if (!NT_SUCCESS(status)) {
+			CBTablePrint(DEBUG_LEVEL_ERROR, DBG_IOCTL, "Failed to get output buffer\n");
+			break;
+		}
+
+		status = classifyAddresses(pDevice, InBuffer, InputBufferLength / sizeof(UINT64), Buffer, &BytesCopied);
+		if (NT_SUCCESS(status)) {
+			WdfRequestSetInformation(FxRequest, BytesCopied);
+		}
+		break;
+	case IOCTL_CBTABLE_READ_OPTIONS:
+		status = WdfRequestRetrieveInputBuffer(FxRequest, sizeof(struct cbtable_option_query), &InBuffer, NULL);
+		if (!NT_SUCCESS(status)) {
+			CBTablePrint(DEBUG_LEVEL_ERROR, DBG_IOCTL, "Failed to get input buffer\n");
+			break;
+		}
+
+		status = WdfRequestRetrieveOutputBuffer(FxRequest, OutputBufferLength, &Buffer, &BufLen);
+		if (!NT_SUCCESS(status)) {
+			CBTablePrint(DEBUG_LEVEL_ERROR, DBG_IOCTL, "Failed to get output buffer\n");
+			break;
+		}
+
+		status = CBTableReadOptions(pDevice, InBuffer, InputBufferLength, Buffer, BufLen, &BytesCopied);
+		if (NT_SUCCESS(status)) {
+			WdfRequestSetInformation(FxRequest, BytesCopied);
+		}
+		break;
+	case IOCTL_CBTABLE_READ_CONSOLE_LINES:
+		status = WdfRequestRetrieveInputBuffer(FxRequest, sizeof(struct cbtable_console_lines_request), &InBuffer, NULL);
+		if (!NT_SUCCESS(status)) {
+			CBTablePrint(DEBUG_LEVEL_ERROR, DBG_IOCTL, "Failed to get input buffer\n");
+			break;
+		}
+
+		status = WdfRequestRetrieveOutputBuffer(FxRequest, sizeof(struct cbtable_console_lines), &Buffer, &BufLen);
+		if (!NT_SUCCESS(status)) {
+			CBTablePrint(DEBUG_LEVEL_ERROR, DBG_IOCTL, "Failed to get output buffer\n");
+			break;
+		}
+
+		status = CBTableReadConsoleLines(pDevice, InBuffer, Buffer, BufLen, &BytesCopied);
+		if (NT_SUCCESS(status) || status == STATUS_BUFFER_OVERFLOW) {
+			WdfRequestSetInformation(FxRequest, BytesCopied);
+		}
+		break;
+	case IOCTL_CBTABLE_GET_STATS:
+		status = WdfRequestRetrieveOutputBuffer(FxRequest, sizeof(struct cbtable_stats), &Buffer, &BufLen);
+		if (!NT_SUCCESS(status)) {
+			CBTablePrint(DEBUG_LEVEL_ERROR, DBG_IOCTL, "Failed to get output buffer\n");
+			break;
+		}
+
+		status = CBTableGetStats(pDevice, Buffer, BufLen, &BytesCopied);
+		if (NT_SUCCESS(status)) {
+			WdfRequestSetInformation(FxRequest, BytesCopied);
+		}
+		break;
+	default:
+		status = STATUS_INVALID_DEVICE_REQUEST;
+		break;
+	}
 
-exit:
 	WdfRequestComplete(FxRequest, status);
 }
 
@@ -256,25 +914,29 @@ OnIoWrite(
 	_In_  size_t      Length
 )
 {
-	WDFDEVICE device;
-	PCBTABLE_CONTEXT pDevice;
-
-	device = WdfIoQueueGetDevice(FxQueue);
-	pDevice = GetDeviceContext(device);
+	UNREFERENCED_PARAMETER(FxQueue);
 
 	NTSTATUS status;
 
 	PVOID Buffer;
 	size_t BufLen;
 
+	WDFFILEOBJECT fileObject = WdfRequestGetFileObject(FxRequest);
+	if (!fileObject) {
+		status = STATUS_INVALID_DEVICE_REQUEST;
+		goto exit;
+	}
+
+	PCBTABLE_FILE_CONTEXT pFile = GetFileContext(fileObject);
+
 	status = WdfRequestRetrieveInputBuffer(FxRequest, Length, &Buffer, &BufLen);
 	if (!NT_SUCCESS(status)) {
-		DbgPrint("Failed to get input buffer\n");
+		CBTablePrint(DEBUG_LEVEL_ERROR, DBG_IOCTL, "Failed to get input buffer\n");
 		goto exit;
 	}
 
-	if (BufLen < sizeof(pDevice->nextRequest)) {
-		DbgPrint("Input buffer too small\n");
+	if (BufLen < sizeof(pFile->nextRequest)) {
+		CBTablePrint(DEBUG_LEVEL_ERROR, DBG_IOCTL, "Input buffer too small\n");
 		status = STATUS_INVALID_PARAMETER;
 	}
 	else {
@@ -283,7 +945,7 @@ OnIoWrite(
 			status = STATUS_INVALID_PARAMETER;
 		}
 		else {
-			pDevice->nextRequest = param;
+			pFile->nextRequest = param;
 		}
 	}
 
@@ -291,213 +953,66 @@ exit:
 	WdfRequestComplete(FxRequest, status);
 }
 
-/*
- * calculate ip checksum (16 bit quantities) on a passed in buffer. In case
- * the buffer length is odd last byte is excluded from the calculation
- */
-static UINT16 ipchcksum(const void* addr, unsigned size)
-{
-	const UINT16* p = addr;
-	unsigned i, n = size / 2; /* don't expect odd sized blocks */
-	UINT32 sum = 0;
-
-	for (i = 0; i < n; i++)
-		sum += p[i];
-
-	sum = (sum >> 16) + (sum & 0xffff);
-	sum += (sum >> 16);
-	sum = ~sum & 0xffff;
-	return (UINT16)sum;
-}
-
-static void mapConsole(PCBTABLE_CONTEXT pDevice) {
-	struct cbmem_console* console_p;
-	size_t size, cursor;
-
-	size = sizeof(*console_p);
-
-	size_t lastMapping = size;
-	console_p = MmMapIoSpace(pDevice->consoleMapping.physAddr, lastMapping, MmCached);
-	if (!console_p)
-		return;
-
-	cursor = console_p->cursor & CBMC_CURSOR_MASK;
-	if (!(console_p->cursor & CBMC_OVERFLOW) && cursor < console_p->size)
-		size = cursor;
-	else
-		size = console_p->size;
-	MmUnmapIoSpace(console_p, lastMapping);
-
-	lastMapping = size + sizeof(*console_p);
-	console_p = MmMapIoSpace(pDevice->consoleMapping.physAddr, lastMapping, MmCached);
-	if (!console_p)
-		return;
-
-	pDevice->consoleMapping.virtAddr = console_p;
-	pDevice->consoleMapping.sz = lastMapping;
-	pDevice->consoleMapping.mapped = TRUE;
-}
-
-static void mapTimestamps(PCBTABLE_CONTEXT pDevice) {
-	struct timestamp_table* timestamp_p;
-	size_t size, cursor;
-
-	size = sizeof(*timestamp_p);
-
-	size_t lastMapping = size;
-	timestamp_p = MmMapIoSpace(pDevice->timestampMapping.physAddr, lastMapping, MmCached);
-	if (!timestamp_p)
-		return;
-
-	size += timestamp_p->num_entries * sizeof(timestamp_p->entries[0]);
-	MmUnmapIoSpace(timestamp_p, lastMapping);
-
-	lastMapping = size;
-	timestamp_p = MmMapIoSpace(pDevice->timestampMapping.physAddr, lastMapping, MmCached);
-	if (!timestamp_p)
-		return;
-
-	pDevice->timestampMapping.virtAddr = timestamp_p;
-	pDevice->timestampMapping.sz = lastMapping;
-	pDevice->timestampMapping.mapped = TRUE;
-}
-
-static void mapTcpa(PCBTABLE_CONTEXT pDevice) {
-	struct tcpa_table* tcpa_p;
-	size_t size, cursor;
-
-	size = sizeof(*tcpa_p);
-
-	size_t lastMapping = size;
-	tcpa_p = MmMapIoSpace(pDevice->tcpaMapping.physAddr, lastMapping, MmCached);
-	if (!tcpa_p)
-		return;
-
-	size += tcpa_p->num_entries * sizeof(tcpa_p->entries[0]);
-	MmUnmapIoSpace(tcpa_p, lastMapping);
-
-	lastMapping = size;
-	tcpa_p = MmMapIoSpace(pDevice->tcpaMapping.physAddr, lastMapping, MmCached);
-	if (!tcpa_p)
-		return;
-
-	pDevice->tcpaMapping.virtAddr = tcpa_p;
-	pDevice->tcpaMapping.sz = lastMapping;
-	pDevice->tcpaMapping.mapped = TRUE;
-}
-
-NTSTATUS
-OnD0Entry(
-_In_  WDFDEVICE               FxDevice,
-_In_  WDF_POWER_DEVICE_STATE  FxPreviousState
+VOID
+OnIoInCallerContext(
+	_In_  WDFDEVICE   FxDevice,
+	_In_  WDFREQUEST  FxRequest
 )
 /*++
-
-Routine Description:
-
-This routine allocates objects needed by the driver.
-
-Arguments:
-
-FxDevice - a handle to the framework device object
-FxPreviousState - previous power state
-
-Return Value:
-
-Status
-
+  Routine Description:
+	Sees every request in the context of the thread that sent it.
+	IOCTL_CBTABLE_MAP_REGION is handled here since it maps into the
+	caller's process; everything else goes on to the queues.
+  Arguments:
+	FxDevice - Handle to the framework device object.
+	FxRequest - Handle to a framework request object.
+  Return Value:
+	None.
 --*/
 {
-	UNREFERENCED_PARAMETER(FxPreviousState);
-	NTSTATUS status = STATUS_SUCCESS;
-
-	PCBTABLE_CONTEXT pDevice = GetDeviceContext(FxDevice);
-
-	struct coreboot_table_header* hdr = pDevice->rootMapping.virtAddr;
-	if (memcmp(hdr->signature, "LBIO", 4) != 0) {
-		DbgPrint("Invalid coreboot table\n");
-		return STATUS_INVALID_DEVICE_STATE;
-	}
-
-	UINT32 checksum = ipchcksum((UINT8*)hdr + hdr->header_bytes, hdr->table_bytes);
-	if (hdr->table_checksum != checksum) {
-		DbgPrint("Invalid cbmem checksum 0x%x vs 0x%x\n", hdr->table_checksum, checksum);
-		return STATUS_INVALID_DEVICE_STATE;
-	}
-
-	UINT8* entryStart = (UINT8 *)hdr + hdr->header_bytes;
-	for (int i = 0; i < hdr->table_entries; i++) {
-		struct coreboot_table_entry* entry = entryStart;
-
-		if (entry->tag == LB_TAG_CBMEM_CONSOLE) {
-			struct lb_cbmem_ref* console = entry;
-			DbgPrint("Found cbmem console at 0x%llx\n", console->cbmem_addr);
-
-			pDevice->consoleMapping.physAddr.QuadPart = console->cbmem_addr;
-
-			mapConsole(pDevice);
-		} else if (entry->tag == LB_TAG_TIMESTAMPS) {
-			struct lb_cbmem_ref* timestamps = entry;
-			DbgPrint("Found cbmem timestamps at 0x%llx\n", timestamps->cbmem_addr);
-
-			pDevice->timestampMapping.physAddr.QuadPart = timestamps->cbmem_addr;
-
-			mapTimestamps(pDevice);
-		} else if (entry->tag == LB_TAG_TCPA_LOG) {
-			struct lb_cbmem_ref* tcpa_log = entry;
-			DbgPrint("Found cbmem tcpa at 0x%llx\n", tcpa_log->cbmem_addr);
-
-			pDevice->tcpaMapping.physAddr.QuadPart = tcpa_log->cbmem_addr;
+	WDF_REQUEST_PARAMETERS params;
+	NTSTATUS status;
 
-			mapTcpa(pDevice);
-		}
+	WDF_REQUEST_PARAMETERS_INIT(&params);
+	WdfRequestGetParameters(FxRequest, &params);
 
-		entryStart += entry->size;
+	if (params.Type == WdfRequestTypeDeviceIoControl &&
+		params.Parameters.DeviceIoControl.IoControlCode == IOCTL_CBTABLE_MAP_REGION) {
+		CBTableMapRegion(GetDeviceContext(FxDevice), FxRequest);
+		return;
 	}
 
-	return status;
+	status = WdfDeviceEnqueueRequest(FxDevice, FxRequest);
+	if (!NT_SUCCESS(status))
+		WdfRequestComplete(FxRequest, status);
 }
 
-NTSTATUS
-OnD0Exit(
-_In_  WDFDEVICE               FxDevice,
-_In_  WDF_POWER_DEVICE_STATE  FxTargetState
+VOID
+OnDeviceCleanup(
+	_In_  WDFOBJECT  Object
 )
 /*++
 
 Routine Description:
 
-This routine destroys objects needed by the driver.
+Frees the region lock and hash providers once the device object goes away.
 
 Arguments:
 
-FxDevice - a handle to the framework device object
-FxTargetState - target power state
+Object - a handle to the framework device object
 
 Return Value:
 
-Status
+None
 
 --*/
 {
-	UNREFERENCED_PARAMETER(FxTargetState);
-
-	NTSTATUS status = STATUS_SUCCESS;
+	PCBTABLE_CONTEXT pDevice = GetDeviceContext(Object);
 
-	PCBTABLE_CONTEXT pDevice = GetDeviceContext(FxDevice);
-	if (pDevice->consoleMapping.mapped) {
-		MmUnmapIoSpace(pDevice->consoleMapping.virtAddr, pDevice->consoleMapping.sz);
-	}
+	if (pDevice->regionLockInitialized)
+		ExDeleteResourceLite(&pDevice->regionLock);
 
-	if (pDevice->timestampMapping.mapped) {
-		MmUnmapIoSpace(pDevice->timestampMapping.virtAddr, pDevice->timestampMapping.sz);
-	}
-
-	if (pDevice->tcpaMapping.mapped) {
-		MmUnmapIoSpace(pDevice->tcpaMapping.virtAddr, pDevice->tcpaMapping.sz);
-	}
-
-	return status;
+	CBTableCloseHashProviders(pDevice);
 }
 
 NTSTATUS
@@ -526,8 +1041,6 @@ IN PWDFDEVICE_INIT DeviceInit
 
 		pnpCallbacks.EvtDevicePrepareHardware = OnPrepareHardware;
 		pnpCallbacks.EvtDeviceReleaseHardware = OnReleaseHardware;
-		pnpCallbacks.EvtDeviceD0Entry = OnD0Entry;
-		pnpCallbacks.EvtDeviceD0Exit = OnD0Exit;
 
 		WdfDeviceInitSetPnpPowerEventCallbacks(DeviceInit, &pnpCallbacks);
 	}
@@ -543,10 +1056,10 @@ IN PWDFDEVICE_INIT DeviceInit
 			&fileObjectConfig,
 			NULL,
 			NULL,
-			NULL);
+			CBTableFileCleanup);
 
 		WDF_OBJECT_ATTRIBUTES fileObjectAttributes;
-		WDF_OBJECT_ATTRIBUTES_INIT(&fileObjectAttributes);
+		WDF_OBJECT_ATTRIBUTES_INIT_CONTEXT_TYPE(&fileObjectAttributes, CBTABLE_FILE_CONTEXT);
 
 		WdfDeviceInitSetFileObjectConfig(
 			DeviceInit,
@@ -554,11 +1067,14 @@ IN PWDFDEVICE_INIT DeviceInit
 			&fileObjectAttributes);
 	}
 
+	WdfDeviceInitSetIoInCallerContextCallback(DeviceInit, OnIoInCallerContext);
+
 	//
 	// Setup the device context
 	//
 
 	WDF_OBJECT_ATTRIBUTES_INIT_CONTEXT_TYPE(&attributes, CBTABLE_CONTEXT);
+	attributes.EvtCleanupCallback = OnDeviceCleanup;
 
 	//
 	// Create a framework device object.This call will in turn create
@@ -579,6 +1095,77 @@ IN PWDFDEVICE_INIT DeviceInit
 	devContext = GetDeviceContext(device);
 	devContext->FxDevice = device;
 
+	status = ExInitializeResourceLite(&devContext->regionLock);
+	if (!NT_SUCCESS(status))
+	{
+		CBTablePrint(DEBUG_LEVEL_ERROR, DBG_PNP,
+			"ExInitializeResourceLite failed 0x%x\n", status);
+
+		return status;
+	}
+
+	devContext->regionLockInitialized = TRUE;
+
+	CBTableOpenHashProviders(devContext);
+
+	//
+	// Idle timer, unmaps the table when nobody has read it for a while
+	//
+
+	{
+		WDF_TIMER_CONFIG timerConfig;
+		WDF_TIMER_CONFIG_INIT(&timerConfig, CBTableIdleTimer);
+		timerConfig.AutomaticSerialization = FALSE;
+
+		WDF_OBJECT_ATTRIBUTES_INIT(&attributes);
+		attributes.ParentObject = device;
+		attributes.ExecutionLevel = WdfExecutionLevelPassive;
+
+		status = WdfTimerCreate(&timerConfig, &attributes, &devContext->idleTimer);
+		if (!NT_SUCCESS(status))
+		{
+			CBTablePrint(DEBUG_LEVEL_ERROR, DBG_PNP,
+				"WdfTimerCreate failed 0x%x\n", status);
+
+			return status;
+		}
+	}
+
+	WDF_OBJECT_ATTRIBUTES_INIT(&attributes);
+	attributes.ParentObject = device;
+
+	status = WdfWaitLockCreate(&attributes, &devContext->lineLock);
+	if (!NT_SUCCESS(status))
+	{
+		CBTablePrint(DEBUG_LEVEL_ERROR, DBG_PNP,
+			"WdfWaitLockCreate failed 0x%x\n", status);
+
+		return status;
+	}
+
+	//
+	// Wait timer, checks on requests pended by IOCTL_CBTABLE_WAIT_CHANGE
+	//
+
+	{
+		WDF_TIMER_CONFIG timerConfig;
+		WDF_TIMER_CONFIG_INIT(&timerConfig, CBTableWaitTimer);
+		timerConfig.AutomaticSerialization = FALSE;
+
+		WDF_OBJECT_ATTRIBUTES_INIT(&attributes);
+		attributes.ParentObject = device;
+		attributes.ExecutionLevel = WdfExecutionLevelPassive;
+
+		status = WdfTimerCreate(&timerConfig, &attributes, &devContext->waitTimer);
+		if (!NT_SUCCESS(status))
+		{
+			CBTablePrint(DEBUG_LEVEL_ERROR, DBG_PNP,
+				"WdfTimerCreate failed 0x%x\n", status);
+
+			return status;
+		}
+	}
+
 	WDF_IO_QUEUE_CONFIG queueConfig;
 	WDFQUEUE queue;
 
@@ -609,21 +1196,29 @@ IN PWDFDEVICE_INIT DeviceInit
 	}
 
 	//
-	// Create I/O queue
+	// Create I/O queue. Readers only take the region lock shared and the
+	// selection state lives in the file object, so requests from
+	// different handles can run concurrently.
 	//
 	WDF_IO_QUEUE_CONFIG_INIT(
 		&queueConfig,
-		WdfIoQueueDispatchSequential);
+		WdfIoQueueDispatchParallel);
 
 	queueConfig.EvtIoRead = OnIoRead;
 	queueConfig.EvtIoWrite = OnIoWrite;
-	//queueConfig.EvtIoDeviceControl = OnIoDeviceControl;
+	queueConfig.EvtIoDeviceControl = OnIoDeviceControl;
 	queueConfig.PowerManaged = WdfTrue;
 
+	//
+	// Regions may be mapped on first use, which needs passive level.
+	//
+	WDF_OBJECT_ATTRIBUTES_INIT(&attributes);
+	attributes.ExecutionLevel = WdfExecutionLevelPassive;
+
 	status = WdfIoQueueCreate(
 		devContext->FxDevice,
 		&queueConfig,
-		WDF_NO_OBJECT_ATTRIBUTES,
+		&attributes,
 		&devContext->CmdQueue
 	);
 	if (!NT_SUCCESS(status))
@@ -634,6 +1229,27 @@ IN PWDFDEVICE_INIT DeviceInit
 		return status;
 	}
 
+	//
+	// Pended wait requests. Not power managed, waiting must not keep the
+	// device out of idle.
+	//
+	WDF_IO_QUEUE_CONFIG_INIT(&queueConfig, WdfIoQueueDispatchManual);
+	queueConfig.PowerManaged = WdfFalse;
+
+	status = WdfIoQueueCreate(
+		devContext->FxDevice,
+		&queueConfig,
+		WDF_NO_OBJECT_ATTRIBUTES,
+		&devContext->WaitQueue
+	);
+	if (!NT_SUCCESS(status))
+	{
+		CBTablePrint(DEBUG_LEVEL_ERROR, DBG_PNP,
+			"WdfIoQueueCreate failed 0x%x\n", status);
+
+		return status;
+	}
+
 	DECLARE_CONST_UNICODE_STRING(dosDeviceName, SYMBOLIC_NAME_STRING);
 
 	status = WdfDeviceCreateSymbolicLink(device,
@@ -1,6 +1,17 @@
 #ifndef __CBTABLE_H__
 #define __CBTABLE_H__
 
+/* Outside of Windows headers, provide the fixed-size types used below */
+#if !defined(_WIN32)
+#include <stddef.h>
+#include <stdint.h>
+typedef uint8_t UINT8;
+typedef uint16_t UINT16;
+typedef uint32_t UINT32;
+typedef uint64_t UINT64;
+typedef int64_t INT64;
+#endif
+
 /* The coreboot table information is for conveying information
  * from the firmware to the loaded OS image.  Primarily this
  * is expected to be information that cannot be discovered by
@@ -116,14 +127,106 @@ struct lb_cbmem_ref {
 	UINT64 cbmem_addr;
 };
 
+/* Describes one CBMEM region */
+struct lb_cbmem_entry {
+	UINT32 tag;
+	UINT32 size;
+
+	UINT64 address;
+	UINT32 entry_size;
+	UINT32 id;
+};
+
+/* Points to another coreboot table */
+struct lb_forward {
+	UINT32 tag;
+	UINT32 size;
+
+	UINT64 forward;
+};
+
+/* Frequency of the timestamp counter */
+struct lb_tsc_info {
+	UINT32 tag;
+	UINT32 size;
+
+	UINT32 freq_khz;
+};
+
+/* 64 bit values in entries that are only 32 bit aligned */
+struct lb_uint64 {
+	UINT32 lo;
+	UINT32 hi;
+};
+
+struct lb_memory_range {
+	struct lb_uint64 start;
+	struct lb_uint64 size;
+	UINT32 type;
+#define LB_MEM_RAM		 1	/* Memory anyone can use */
+#define LB_MEM_RESERVED		 2	/* Don't use this memory region */
+#define LB_MEM_ACPI		 3	/* ACPI Tables */
+#define LB_MEM_NVS		 4	/* ACPI NVS Memory */
+#define LB_MEM_UNUSABLE		 5	/* Unusable address space */
+#define LB_MEM_VENDOR_RSVD	 6	/* Vendor Reserved */
+#define LB_MEM_TABLE		16	/* Ram configuration tables are kept in */
+};
+
+struct lb_memory {
+	UINT32 tag;
+	UINT32 size;
+
+	struct lb_memory_range map[0];
+};
+
+/* CMOS option table, its own entries follow at header_length */
+struct cmos_option_table {
+	UINT32 tag;
+	UINT32 size;
+	UINT32 header_length;
+};
+
+struct cmos_entries {
+	UINT32 tag;		/* LB_TAG_OPTION */
+	UINT32 size;
+	UINT32 bit;		/* starting bit from start of image */
+	UINT32 length;		/* length of field in bits */
+	UINT32 config;		/* 'e' enum, 'h' hex, 's' string, 'r' reserved */
+	UINT32 config_id;	/* cmos_enums with this id belong to the entry */
+#define CMOS_MAX_NAME_LENGTH 32
+	UINT8 name[CMOS_MAX_NAME_LENGTH];
+};
+
+struct cmos_enums {
+	UINT32 tag;		/* LB_TAG_OPTION_ENUM */
+	UINT32 size;
+	UINT32 config_id;
+	UINT32 value;
+#define CMOS_MAX_TEXT_LENGTH 32
+	UINT8 text[CMOS_MAX_TEXT_LENGTH];
+};
+
+struct cmos_defaults {
+	UINT32 tag;		/* LB_TAG_OPTION_DEFAULTS */
+	UINT32 size;
+	UINT32 name_length;
+	UINT8 name[CMOS_MAX_NAME_LENGTH];
+#define CMOS_IMAGE_BUFFER_SIZE 256
+	UINT8 default_set[CMOS_IMAGE_BUFFER_SIZE];
+};
+
 struct cbmem_console {
 	UINT32 size;
 	UINT32 cursor;
 };
 #define CBMC_CURSOR_MASK ((1 << 28) - 1)
-#define CBMC_OVERFLOW (1 << 31)
+#define CBMC_OVERFLOW (1u << 31)
+
+/* log level byte newer coreboot stores in front of every console line */
+#define CBMC_LOG_MARKER_FIRST 0x10
+#define CBMC_LOG_MARKER_LAST  0x18
 
-#include <pshpack1.h>
+#pragma pack(push, 1)
 struct timestamp_entry {
 	UINT32	entry_id;
 	INT64	entry_stamp;
@@ -158,6 +261,6 @@ struct tcpa_table {
 	struct tcpa_entry entries[0]; /* Variable number of entries */
 };
 
-#include <poppack.h>
+#pragma pack(pop)
 
 #endif /* __CBTABLE_H__ */
\ No newline at end of file
@@ -0,0 +1,253 @@
+#include "driver.h"
+
+#if defined(_M_AMD64)
+#include <emmintrin.h>
+#endif
+
+//
+// Line index over the console text, in the same chronological order
+// IOCTL_CBTABLE_READ_REGION returns it.
+//
+// The index holds the offset of every line and the line each coreboot
+// stage banner was printed on. It is built on the first request and
+// afterwards only the text appended since then is scanned. A console that
+// has wrapped shifts under the index with every new byte, so it is
+// rebuilt whenever its cursor moves. Stage banners are recognized by
+// cb_console_line_stage from cbparse.h.
+//
+// lineLock serializes updates; it is taken with regionLock held shared,
+// and the index is freed with the rest of the table while regionLock is
+// held exclusive.
+//
+
+#define LINE_INDEX_INITIAL 1024
+
+static NTSTATUS addLine(CBTABLE_LINE_INDEX* index, UINT32 offset) {
+	if (index->count == index->capacity) {
+		UINT32 capacity = index->capacity ? index->capacity * 2 : LINE_INDEX_INITIAL;
+		UINT32* starts;
+
+		//
+		// Large consoles run to millions of lines; the index is only
+		// touched at passive level, so keep it out of nonpaged pool.
+		//
+		starts = ExAllocatePoolWithTag(PagedPool, capacity * sizeof(starts[0]), CBTABLE_POOL_TAG);
+		if (!starts)
+			return STATUS_INSUFFICIENT_RESOURCES;
+
+		if (index->starts) {
+			RtlCopyMemory(starts, index->starts, index->count * sizeof(starts[0]));
+			ExFreePoolWithTag(index->starts, CBTABLE_POOL_TAG);
+		}
+
+		index->starts = starts;
+		index->capacity = capacity;
+	}
+
+	index->starts[index->count++] = offset;
+	return STATUS_SUCCESS;
+}
+
+/*
+ * a newline at offset ends the current last line and starts the next one
+ */
+static NTSTATUS endLine(CBTABLE_LINE_INDEX* index, struct cb_console_text* text, UINT32 offset) {
+	UINT32 lineStart = index->starts[index->count - 1];
+	UINT32 stage = cb_console_line_stage(text, lineStart, offset - lineStart);
+
+	if (stage)
+		index->stageLine[stage] = index->count - 1;
+
+	return addLine(index, offset + 1);
+}
+
+/*
+ * scans len contiguous bytes of the ring that hold the text at offset
+ */
+static NTSTATUS scanSegment(CBTABLE_LINE_INDEX* index, struct cb_console_text* text, const UINT8* p, UINT32 len, UINT32 offset) {
+	NTSTATUS status;
+	UINT32 i = 0;
+
+#if defined(_M_AMD64)
+	const __m128i newline = _mm_set1_epi8('\n');
+
+	for (; i + 16 <= len; i += 16) {
+		__m128i chunk = _mm_loadu_si128((const __m128i*)(p + i));
+		ULONG mask = (ULONG)_mm_movemask_epi8(_mm_cmpeq_epi8(chunk, newline));
+
+		while (mask) {
+			ULONG bit;
+
+			_BitScanForward(&bit, mask);
+			mask &= mask - 1;
+
+			status = endLine(index, text, offset + i + bit);
+			if (!NT_SUCCESS(status))
+				return status;
+		}
+	}
+#endif
+
+	for (; i < len; i++) {
+		if (p[i] != '\n')
+			continue;
+
+		status = endLine(index, text, offset + i);
+		if (!NT_SUCCESS(status))
+			return status;
+	}
+
+	return STATUS_SUCCESS;
+}
+
+static NTSTATUS resetIndex(CBTABLE_LINE_INDEX* index) {
+	index->count = 0;
+	index->scanned = 0;
+
+	for (UINT32 stage = 0; stage < CBTABLE_STAGE_COUNT; stage++)
+		index->stageLine[stage] = CBTABLE_LINE_NONE;
+
+	return addLine(index, 0);
+}
+
+/*
+ * brings the index up to date with the console text, with lineLock held
+ */
+static NTSTATUS updateIndex(CBTABLE_LINE_INDEX* index, struct cb_console_text* text) {
+	UINT32 cursor = text->cursor;
+	NTSTATUS status;
+
+	if (!index->count || text->length < index->scanned ||
+		((cursor & CBMC_OVERFLOW) && cursor != index->cursor) ||
+		((cursor ^ index->cursor) & CBMC_OVERFLOW)) {
+		status = resetIndex(index);
+		if (!NT_SUCCESS(status))
+			goto fail;
+	}
+
+	while (index->scanned < text->length) {
+		UINT32 pos = cb_console_pos(text, index->scanned);
+		UINT32 len = min(text->length - index->scanned, text->size - pos);
+
+		status = scanSegment(index, text, text->ring + pos, len, index->scanned);
+		if (!NT_SUCCESS(status))
+			goto fail;
+
+		index->scanned += len;
+	}
+
+	index->cursor = cursor;
+	return STATUS_SUCCESS;
+
+fail:
+	index->count = 0;
+	index->scanned = 0;
+	return status;
+}
+
+/* offset of the start of line n, or the end of the text for n == count */
+static UINT32 lineOffset(CBTABLE_LINE_INDEX* index, UINT32 n) {
+	return n < index->count ? index->starts[n] : index->scanned;
+}
+
+/* line after the banner of stage, where the next stage begins */
+static UINT32 stageEnd(CBTABLE_LINE_INDEX* index, UINT32 first) {
+	UINT32 end = index->count;
+
+	for (UINT32 stage = 0; stage < CBTABLE_STAGE_COUNT; stage++) {
+		UINT32 line = index->stageLine[stage];
+
+		if (line != CBTABLE_LINE_NONE && line > first && line < end)
+			end = line;
+	}
+	return end;
+}
+
+NTSTATUS CBTableReadConsoleLines(PCBTABLE_CONTEXT pDevice, struct cbtable_console_lines_request* request, PVOID Buffer, size_t BufLen, size_t *BytesCopied) {
+	struct cbtable_console_lines* out = Buffer;
+	CBTABLE_LINE_INDEX* index = &pDevice->lines;
+	MemMapping* mapping;
+	struct cb_console_text text;
+	UINT32 first, last;
+	NTSTATUS status;
+
+	*BytesCopied = 0;
+
+	if (BufLen < sizeof(*out))
+		return STATUS_BUFFER_TOO_SMALL;
+
+	if (request->stage >= CBTABLE_STAGE_COUNT)
+		return STATUS_INVALID_PARAMETER;
+
+	status = CBTableAcquireRegion(pDevice, NextRequestConsole, &mapping);
+	if (!NT_SUCCESS(status))
+		return status;
+
+	WdfWaitLockAcquire(pDevice->lineLock, NULL);
+
+	cb_console_view(mapping->virtAddr, mapping->sz, &text);
+
+	status = updateIndex(index, &text);
+	if (!NT_SUCCESS(status))
+		goto exit;
+
+	if (request->stage) {
+		first = index->stageLine[request->stage];
+		if (first == CBTABLE_LINE_NONE) {
+			status = STATUS_NOT_FOUND;
+			goto exit;
+		}
+		last = stageEnd(index, first);
+	}
+	else {
+		first = min(request->first_line, index->count);
+		last = index->count;
+	}
+
+	if (request->line_count && request->line_count < last - first)
+		last = first + request->line_count;
+
+	//
+	// Hand out as many whole lines as fit, found by binary search on the
+	// line offsets
+	//
+	size_t room = BufLen - sizeof(*out);
+	UINT32 lo = first, hi = last;
+	while (lo < hi) {
+		UINT32 mid = hi - (hi - lo) / 2;
+		if (lineOffset(index, mid) - lineOffset(index, first) <= room)
+			lo = mid;
+		else
+			hi = mid - 1;
+	}
+
+	out->first_line = first;
+	out->line_count = lo - first;
+	out->total_lines = index->count;
+	out->length = lineOffset(index, lo) - lineOffset(index, first);
+	RtlCopyMemory(out->stage_lines, index->stageLine, sizeof(out->stage_lines));
+	*BytesCopied = sizeof(*out);
+
+	if (lo == first && last > first) {
+		status = STATUS_BUFFER_OVERFLOW;
+		goto exit;
+	}
+
+	cb_console_copy(&text, lineOffset(index, first), (UINT8*)(out + 1), out->length);
+	*BytesCopied += out->length;
+
+exit:
+	WdfWaitLockRelease(pDevice->lineLock);
+	CBTableRelease(pDevice);
+	return status;
+}
+
+/*
+ * with regionLock held exclusive, or when no request can be running
+ */
+VOID CBTableFreeLineIndex(PCBTABLE_CONTEXT pDevice) {
+	if (pDevice->lines.starts)
+		ExFreePoolWithTag(pDevice->lines.starts, CBTABLE_POOL_TAG);
+
+	RtlZeroMemory(&pDevice->lines, sizeof(pDevice->lines));
+}
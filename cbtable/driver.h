@@ -11,8 +11,11 @@
 #pragma warning(default:4201)
 #pragma warning(default:4214)
 #include <wdf.h>
+#include <bcrypt.h>
 
-#include "cbtable.h"
+#include "cbparse.h"
+#include "public.h"
+#include "trace.h"
 
 //
 // String definitions
@@ -37,13 +40,60 @@ typedef struct MEMMAPPING {
 	size_t sz;
 } MemMapping, PMemMapping;
 
-enum NextRequest {
-	NextRequestConsole,
-	NextRequestTimestamps,
-	NextRequestRoot,
-	NextRequestTcpa,
-	NextRequestReserved
-};
+//
+// Every LB_TAG_* value fits below this, so the tag index is a flat array
+//
+
+#define CBTABLE_TAG_COUNT (LB_TAG_OPTION_CHECKSUM + 1)
+
+//
+// Mappings are dropped after this long without a request
+//
+
+#define CBTABLE_IDLE_UNMAP_MS 60000
+
+//
+// How often requests pended by IOCTL_CBTABLE_WAIT_CHANGE are checked
+//
+
+#define CBTABLE_WAIT_POLL_MS 250
+
+typedef struct _CBTABLE_TAG_INDEX {
+	UINT32 first;
+	UINT32 count;
+} CBTABLE_TAG_INDEX;
+
+//
+// Offsets of the lines of the console text, see conlines.c
+//
+
+typedef struct _CBTABLE_LINE_INDEX {
+	UINT32* starts;
+	UINT32 count;
+	UINT32 capacity;
+	UINT32 scanned;		// bytes of text covered by the index
+	UINT32 cursor;		// console cursor at the last update
+	UINT32 stageLine[CBTABLE_STAGE_COUNT];
+} CBTABLE_LINE_INDEX;
+
+//
+// Request and mapping counters, see stats.c
+//
+
+typedef struct _CBTABLE_REGION_STATS {
+	volatile LONG64 reads;
+	volatile LONG64 bytes;
+	volatile LONG64 maps;
+	volatile LONG64 mapUs;
+	volatile LONG64 latency[CBTABLE_LATENCY_BUCKETS];
+} CBTABLE_REGION_STATS;
+
+typedef struct _CBTABLE_STATS {
+	volatile LONG64 checksums;
+	volatile LONG64 checksumBytes;
+	volatile LONG64 checksumUs;
+	CBTABLE_REGION_STATS regions[CBTABLE_STATS_REGIONS];
+} CBTABLE_STATS;
 
 typedef struct _CBTABLE_CONTEXT
 {
@@ -56,19 +106,114 @@ typedef struct _CBTABLE_CONTEXT
 
 	WDFQUEUE CmdQueue;
 
+	//
+	// Manual queue of IOCTL_CBTABLE_WAIT_CHANGE requests, checked by
+	// waitTimer, which is only armed while the queue holds requests
+	//
+
+	WDFQUEUE WaitQueue;
+	WDFTIMER waitTimer;
+	volatile LONG waitArmed;
+
+	//
+	// Held shared while reading a mapping, exclusive while mapping or
+	// unmapping. Everything below is only valid while parsed is set.
+	//
+
+	ERESOURCE regionLock;
+	BOOLEAN regionLockInitialized;
+	BOOLEAN parsed;
+	volatile LONG64 lastAccess;
+	WDFTIMER idleTimer;
+
 	MemMapping rootMapping;
 	MemMapping consoleMapping;
 	MemMapping timestampMapping;
 	MemMapping tcpaMapping;
 
-	enum NextRequest nextRequest;
+	//
+	// Table reached through LB_TAG_FORWARD, if any
+	//
+
+	MemMapping forwardMapping;
+
+	//
+	// Entries of the root and forwarded tables grouped by tag.
+	// tagIndex[tag] gives the range of tagEntries holding that tag.
+	//
+
+	struct coreboot_table_entry** tagEntries;
+	CBTABLE_TAG_INDEX tagIndex[CBTABLE_TAG_COUNT];
+
+	//
+	// One mapping per LB_TAG_CBMEM_ENTRY, in tag index order. These are
+	// only mapped the first time a client reads them.
+	//
+
+	MemMapping* cbmemMappings;
 
 	UINT32 entryCount;
 
+	//
+	// LB_TAG_MEMORY as sorted, non-overlapping ranges
+	//
+
+	struct cbtable_memory_range* memoryRanges;
+	UINT32 memoryRangeCount;
+
+	//
+	// LB_TAG_CMOS_OPTION_TABLE and its options sorted by name
+	//
+
+	struct cmos_option_table* optionTable;
+	struct cmos_entries** optionIndex;
+	UINT32 optionCount;
+
+	//
+	// Opened once at device add, NULL if the algorithm is unavailable
+	//
+
+	BCRYPT_ALG_HANDLE hashAlg[CBTABLE_PCR_BANKS];
+
+	//
+	// Console line index, updated under lineLock
+	//
+
+	WDFWAITLOCK lineLock;
+	CBTABLE_LINE_INDEX lines;
+
+	CBTABLE_STATS stats;
+
 } CBTABLE_CONTEXT, *PCBTABLE_CONTEXT;
 
 WDF_DECLARE_CONTEXT_TYPE_WITH_NAME(CBTABLE_CONTEXT, GetDeviceContext)
 
+typedef struct _CBTABLE_FILE_CONTEXT
+{
+
+	//
+	// Region selected by the last WriteFile on this handle
+	//
+
+	enum NextRequest nextRequest;
+
+} CBTABLE_FILE_CONTEXT, *PCBTABLE_FILE_CONTEXT;
+
+WDF_DECLARE_CONTEXT_TYPE_WITH_NAME(CBTABLE_FILE_CONTEXT, GetFileContext)
+
+typedef struct _CBTABLE_WAIT_CONTEXT
+{
+
+	//
+	// State the caller of a pended IOCTL_CBTABLE_WAIT_CHANGE last saw
+	//
+
+	struct cbtable_wait_state seen;
+
+} CBTABLE_WAIT_CONTEXT, *PCBTABLE_WAIT_CONTEXT;
+
+WDF_DECLARE_CONTEXT_TYPE_WITH_NAME(CBTABLE_WAIT_CONTEXT, GetWaitContext)
+
 //
 // Function definitions
 //
@@ -81,29 +226,76 @@ EVT_WDF_DRIVER_DEVICE_ADD CBTableEvtDeviceAdd;
 
 EVT_WDF_IO_QUEUE_IO_INTERNAL_DEVICE_CONTROL CBTableEvtInternalDeviceControl;
 
+EVT_WDF_TIMER CBTableIdleTimer;
+
+EVT_WDF_TIMER CBTableWaitTimer;
+
+//
+// table.c
+//
+
+NTSTATUS CBTableAcquire(PCBTABLE_CONTEXT pDevice);
+NTSTATUS CBTableAcquireRegion(PCBTABLE_CONTEXT pDevice, enum NextRequest region, MemMapping** mapping);
+NTSTATUS CBTableAcquireCbmem(PCBTABLE_CONTEXT pDevice, UINT32 id, MemMapping** mapping);
+NTSTATUS CBTableAcquireAllRegions(PCBTABLE_CONTEXT pDevice);
+NTSTATUS CBTableQueryRegion(PCBTABLE_CONTEXT pDevice, enum NextRequest region, struct cbtable_region_info* info);
+VOID CBTableRelease(PCBTABLE_CONTEXT pDevice);
+VOID CBTableReleaseAll(PCBTABLE_CONTEXT pDevice);
+
+struct coreboot_table_entry* CBTableGetEntry(PCBTABLE_CONTEXT pDevice, UINT32 tag, UINT32 instance);
+MemMapping* CBTableGetRegion(PCBTABLE_CONTEXT pDevice, UINT32 region);
+
+//
+// timestamps.c
+//
+
+NTSTATUS CBTableDecodeTimestamps(PCBTABLE_CONTEXT pDevice, PVOID Buffer, size_t BufLen, size_t *BytesCopied);
+
+//
+// conlines.c
+//
+
+NTSTATUS CBTableReadConsoleLines(PCBTABLE_CONTEXT pDevice, struct cbtable_console_lines_request* request, PVOID Buffer, size_t BufLen, size_t *BytesCopied);
+VOID CBTableFreeLineIndex(PCBTABLE_CONTEXT pDevice);
+
+//
+// stats.c
+//
+
+VOID CBTableStatsInit(VOID);
+UINT64 CBTableStatsStart(VOID);
+VOID CBTableStatsRead(PCBTABLE_CONTEXT pDevice, UINT32 region, size_t bytes, UINT64 start);
+VOID CBTableStatsMap(PCBTABLE_CONTEXT pDevice, UINT32 region, UINT64 start);
+VOID CBTableStatsChecksum(PCBTABLE_CONTEXT pDevice, size_t bytes, UINT64 start);
+NTSTATUS CBTableGetStats(PCBTABLE_CONTEXT pDevice, PVOID Buffer, size_t BufLen, size_t *BytesCopied);
+
 //
-// Helper macros
+// options.c
 //
 
-#define DEBUG_LEVEL_ERROR   1
-#define DEBUG_LEVEL_INFO    2
-#define DEBUG_LEVEL_VERBOSE 3
+NTSTATUS CBTableReadOptions(PCBTABLE_CONTEXT pDevice, PVOID InBuffer, size_t InLen, PVOID Buffer, size_t BufLen, size_t *BytesCopied);
+
+//
+// tcpa.c
+//
+
+NTSTATUS CBTableReplayPcrs(PCBTABLE_CONTEXT pDevice, PVOID Buffer, size_t BufLen, size_t *BytesCopied);
+VOID CBTableOpenHashProviders(PCBTABLE_CONTEXT pDevice);
+VOID CBTableCloseHashProviders(PCBTABLE_CONTEXT pDevice);
+
+//
+// view.c
+//
+
+VOID CBTableMapRegion(PCBTABLE_CONTEXT pDevice, WDFREQUEST FxRequest);
+VOID CBTableViewsInit(VOID);
+VOID CBTableViewsUnload(VOID);
+EVT_WDF_FILE_CLEANUP CBTableFileCleanup;
+
+//
+// wait.c
+//
 
-#define DBG_INIT  1
-#define DBG_PNP   2
-#define DBG_IOCTL 4
+NTSTATUS CBTableWaitForChange(PCBTABLE_CONTEXT pDevice, WDFREQUEST FxRequest, struct cbtable_wait_state* seen);
 
-#if 1
-#define CBTablePrint(dbglevel, dbgcatagory, fmt, ...) {          \
-    if (CBTableDebugLevel >= dbglevel &&                         \
-        (CBTableDebugCatagories && dbgcatagory))                 \
-		    {                                                           \
-        DbgPrint(DRIVERNAME);                                   \
-        DbgPrint(fmt, __VA_ARGS__);                             \
-		    }                                                           \
-}
-#else
-#define CBTablePrint(dbglevel, fmt, ...) {                       \
-}
-#endif
 #endif
\ No newline at end of file
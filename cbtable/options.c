@@ -0,0 +1,100 @@
+#include "driver.h"
+
+//
+// Batched lookup of CMOS options by name, against the index built from
+// LB_TAG_CMOS_OPTION_TABLE when the table is parsed.
+//
+
+static void copyText(char* text, const UINT8* src, size_t len) {
+	len = min(len, RTL_FIELD_SIZE(struct cbtable_option_value, text) - 1);
+
+	RtlCopyMemory(text, src, len);
+	text[len] = '\0';
+}
+
+static void readOption(PCBTABLE_CONTEXT pDevice, const UINT8* name, const UINT8* image, size_t imageLen, struct cbtable_option_value* value) {
+	struct cmos_entries* option;
+
+	RtlZeroMemory(value, sizeof(*value));
+
+	option = cb_option_find(pDevice->optionIndex, pDevice->optionCount, name);
+	if (!option)
+		return;
+
+	value->flags = CBTABLE_OPTION_FOUND;
+	value->config = option->config;
+	value->bit = option->bit;
+	value->length = option->length;
+
+	if (!image)
+		return;
+
+	//
+	// Strings are byte aligned and can be longer than value holds
+	//
+	if (option->config == 's') {
+		size_t offset = option->bit / 8;
+		size_t len = option->length / 8;
+
+		if (offset < imageLen && len <= imageLen - offset) {
+			copyText(value->text, image + offset, len);
+			value->flags |= CBTABLE_OPTION_VALUE;
+		}
+		return;
+	}
+
+	if (!cb_option_value(image, imageLen, option, &value->value))
+		return;
+
+	value->flags |= CBTABLE_OPTION_VALUE;
+
+	if (option->config == 'e') {
+		struct cmos_enums* option_enum = cb_option_enum(pDevice->optionTable, option->config_id, (UINT32)value->value);
+
+		if (option_enum) {
+			copyText(value->text, option_enum->text, sizeof(option_enum->text));
+			value->flags |= CBTABLE_OPTION_ENUM;
+		}
+	}
+}
+
+NTSTATUS CBTableReadOptions(PCBTABLE_CONTEXT pDevice, PVOID InBuffer, size_t InLen, PVOID Buffer, size_t BufLen, size_t *BytesCopied) {
+	struct cbtable_option_query* query = InBuffer;
+	struct cbtable_option_value* values = Buffer;
+	const UINT8* names = (const UINT8*)(query + 1);
+	const UINT8* image;
+	size_t imageLen;
+	NTSTATUS status;
+
+	*BytesCopied = 0;
+
+	if (InLen < sizeof(*query) ||
+		query->count > (InLen - sizeof(*query)) / CBTABLE_OPTION_NAME_MAX ||
+		query->image_length > InLen - sizeof(*query) - query->count * CBTABLE_OPTION_NAME_MAX)
+		return STATUS_INVALID_PARAMETER;
+
+	if (BufLen / sizeof(values[0]) < query->count)
+		return STATUS_BUFFER_TOO_SMALL;
+
+	status = CBTableAcquire(pDevice);
+	if (!NT_SUCCESS(status))
+		return status;
+
+	image = names + query->count * CBTABLE_OPTION_NAME_MAX;
+	imageLen = query->image_length;
+
+	if (!imageLen) {
+		struct cmos_defaults* defaults = pDevice->optionTable ? cb_option_defaults(pDevice->optionTable) : NULL;
+
+		image = defaults ? defaults->default_set : NULL;
+		imageLen = defaults ? sizeof(defaults->default_set) : 0;
+	}
+
+	for (UINT32 i = 0; i < query->count; i++)
+		readOption(pDevice, names + i * CBTABLE_OPTION_NAME_MAX, image, imageLen, &values[i]);
+
+	CBTableRelease(pDevice);
+
+	*BytesCopied = query->count * sizeof(values[0]);
+	return STATUS_SUCCESS;
+}
@@ -0,0 +1,528 @@
+#if !defined(_CBTABLE_PUBLIC_H_)
+#define _CBTABLE_PUBLIC_H_
+
+#include "timestamps.h"
+
+//
+// Interface shared with user-mode clients of \\.\BOOT0000
+//
+
+//
+// WriteFile of a UINT32 region id selects the region the next ReadFile on
+// that handle returns. Every ReadFile starts at the beginning of the region
+// and switches the handle back to the console; IOCTL_CBTABLE_READ_REGION_AT
+// reads a region in chunks.
+//
+
+enum NextRequest {
+	NextRequestConsole,
+	NextRequestTimestamps,
+	NextRequestRoot,
+	NextRequestTcpa,
+	NextRequestReserved
+};
+
+//
+// IOCTL_CBTABLE_READ_REGION
+//
+// Input:  UINT32 region id (enum NextRequest)
+// Output: contents of the region, truncated to the output buffer length
+//
+// A console that has wrapped (CBMC_OVERFLOW set in its cursor) is returned
+// oldest text first rather than in storage order.
+//
+// Equivalent to WriteFile(region) followed by ReadFile, in a single request.
+//
+
+#define IOCTL_CBTABLE_READ_REGION \
+	CTL_CODE(FILE_DEVICE_UNKNOWN, 0x800, METHOD_OUT_DIRECT, FILE_READ_ACCESS)
+
+//
+// IOCTL_CBTABLE_READ_REGION_AT
+//
+// Input:  struct cbtable_region_read
+// Output: up to the output buffer length of the region, starting at offset
+//
+// Offsets are into the same view IOCTL_CBTABLE_READ_REGION returns, so a
+// region can be read in fixed size chunks until a short read. Reading at
+// or past the end returns no data.
+//
+
+#define IOCTL_CBTABLE_READ_REGION_AT \
+	CTL_CODE(FILE_DEVICE_UNKNOWN, 0x808, METHOD_OUT_DIRECT, FILE_READ_ACCESS)
+
+struct cbtable_region_read {
+	UINT32 region;
+	UINT32 reserved;
+	UINT64 offset;
+};
+
+//
+// IOCTL_CBTABLE_READ_CONSOLE_TAIL
+//
+// Input:  struct cbtable_console_tail_request
+// Output: struct cbtable_console_tail, followed by tail.length bytes of
+//         console text written since the cursor in the request
+//
+// Pass 0 as the cursor for the first call, then the cursor returned by the
+// previous call. Text is always returned in chronological order, including
+// across the wrap point of an overflowed console. If the console has not changed, no text is returned. If
+// the output buffer is too small the returned cursor only covers the text
+// that was copied, so the next call continues where this one stopped.
+//
+
+#define IOCTL_CBTABLE_READ_CONSOLE_TAIL \
+	CTL_CODE(FILE_DEVICE_UNKNOWN, 0x801, METHOD_OUT_DIRECT, FILE_READ_ACCESS)
+
+struct cbtable_console_tail_request {
+	UINT32 cursor;
+};
+
+//
+// The cursor passed in no longer matches the console (it was overwritten
+// or reset). Any text returned starts at the oldest text in the buffer.
+//
+#define CBTABLE_CONSOLE_TAIL_RESET 0x1
+
+struct cbtable_console_tail {
+	UINT32 cursor;
+	UINT32 flags;
+	UINT32 length;
+	UINT32 reserved;
+};
+
+//
+// IOCTL_CBTABLE_GET_ENTRY
+//
+// Input:  struct cbtable_entry_request
+// Output: the coreboot table entry, starting with its tag and size,
+//         truncated to the output buffer length
+//
+// instance selects between entries that share a tag (LB_TAG_CBMEM_ENTRY,
+// LB_TAG_GPIO, ...). Entries of a table reached through LB_TAG_FORWARD are
+// included. Fails with STATUS_NOT_FOUND if there is no such entry.
+//
+
+#define IOCTL_CBTABLE_GET_ENTRY \
+	CTL_CODE(FILE_DEVICE_UNKNOWN, 0x802, METHOD_OUT_DIRECT, FILE_READ_ACCESS)
+
+struct cbtable_entry_request {
+	UINT32 tag;
+	UINT32 instance;
+};
+
+//
+// IOCTL_CBTABLE_LIST_CBMEM
+//
+// Output: struct cbtable_cbmem_directory
+//
+// count is always the total number of CBMEM entries; only as many entries
+// as fit in the output buffer are filled in.
+//
+
+#define IOCTL_CBTABLE_LIST_CBMEM \
+	CTL_CODE(FILE_DEVICE_UNKNOWN, 0x803, METHOD_OUT_DIRECT, FILE_READ_ACCESS)
+
+struct cbtable_cbmem_info {
+	UINT32 id;
+	UINT32 size;
+	UINT64 address;
+};
+
+struct cbtable_cbmem_directory {
+	UINT32 count;
+	UINT32 reserved;
+	struct cbtable_cbmem_info entries[0];
+};
+
+//
+// IOCTL_CBTABLE_READ_CBMEM
+//
+// Input:  UINT32 CBMEM id (CBMEM_ID_* in coreboot)
+// Output: contents of the CBMEM entry, truncated to the output buffer length
+//
+// Fails with STATUS_NOT_FOUND if the table has no entry with that id.
+//
+
+#define IOCTL_CBTABLE_READ_CBMEM \
+	CTL_CODE(FILE_DEVICE_UNKNOWN, 0x804, METHOD_OUT_DIRECT, FILE_READ_ACCESS)
+
+//
+// IOCTL_CBTABLE_READ_TIMESTAMPS_DECODED
+//
+// Output: struct cbtable_timestamps
+//
+// Entries are sorted by time. absolute_us includes the table's base_time
+// and is converted with the LB_TAG_TSC_INFO frequency when the table has
+// one, otherwise with tick_freq_mhz. delta_us is the time since the
+// previous entry (0 for the first). See timestamps.h for id names.
+//
+// If the output buffer cannot hold every entry, only the header is
+// returned and the request fails with STATUS_BUFFER_OVERFLOW.
+//
+
+#define IOCTL_CBTABLE_READ_TIMESTAMPS_DECODED \
+	CTL_CODE(FILE_DEVICE_UNKNOWN, 0x805, METHOD_OUT_DIRECT, FILE_READ_ACCESS)
+
+struct cbtable_timestamp {
+	UINT32 id;
+	UINT32 reserved;
+	INT64 absolute_us;
+	UINT64 delta_us;
+};
+
+struct cbtable_timestamps {
+	UINT32 count;
+	UINT32 reserved;
+	struct cbtable_timestamp entries[0];
+};
+
+//
+// IOCTL_CBTABLE_SNAPSHOT
+//
+// Output: struct cbtable_snapshot_header, followed by the region payloads
+//
+// Captures the root table and every region present in it in one
+// self-describing image that can be written to a file as-is. Payloads are
+// placed at offsets that are multiples of CBTABLE_SNAPSHOT_ALIGN, so a
+// reader that maps the file can reach any region directly from the index.
+// The console payload is the raw cbmem_console in storage order; use its
+// cursor to find the oldest text of a wrapped console.
+//
+// When the root table only holds LB_TAG_FORWARD, the table it forwards to
+// is captured as its own region, CBTABLE_SNAPSHOT_FORWARD, laid out like
+// the root table. All regions are read under one hold of the table lock,
+// so they all come from the same parse of the table.
+//
+// If the output buffer cannot hold the whole image, only the header and
+// index are returned and the request fails with STATUS_BUFFER_OVERFLOW.
+// total_bytes then gives the size to retry with; allow some slack, the
+// console may still be growing.
+//
+
+#define IOCTL_CBTABLE_SNAPSHOT \
+	CTL_CODE(FILE_DEVICE_UNKNOWN, 0x806, METHOD_OUT_DIRECT, FILE_READ_ACCESS)
+
+#define CBTABLE_SNAPSHOT_VERSION 2
+#define CBTABLE_SNAPSHOT_ALIGN 0x1000
+#define CBTABLE_SNAPSHOT_FORWARD 0x100
+
+struct cbtable_snapshot_region {
+	UINT32 region;		// enum NextRequest or CBTABLE_SNAPSHOT_FORWARD
+	UINT32 reserved;
+	UINT64 address;		// physical address the region was read from
+	UINT64 offset;		// from the start of the snapshot
+	UINT64 bytes;
+};
+
+struct cbtable_snapshot_header {
+	char signature[4];	// "CBSN"
+	UINT32 version;
+	UINT32 header_bytes;	// this header plus the region index
+	UINT32 region_count;
+	UINT64 total_bytes;
+	struct cbtable_snapshot_region regions[0];
+};
+
+//
+// IOCTL_CBTABLE_WAIT_CHANGE
+//
+// Input:  struct cbtable_wait_state last returned by this IOCTL (zeroed
+//         on the first call)
+// Output: struct cbtable_wait_state
+//
+// Completes as soon as the console cursor or the number of timestamps
+// differs from the input, returning the new values. The request stays
+// pending until then, or until it is cancelled. A region the table does
+// not have reads as 0.
+//
+
+#define IOCTL_CBTABLE_WAIT_CHANGE \
+	CTL_CODE(FILE_DEVICE_UNKNOWN, 0x807, METHOD_OUT_DIRECT, FILE_READ_ACCESS)
+
+struct cbtable_wait_state {
+	UINT32 console_cursor;
+	UINT32 timestamp_count;
+};
+
+//
+// IOCTL_CBTABLE_QUERY_REGIONS
+//
+// Output: struct cbtable_regions with one entry per region id
+//
+// bytes is what IOCTL_CBTABLE_READ_REGION would return right now. entries
+// is the number of table entries, timestamps or TCPA records in use and
+// max_entries the number the region has room for (0 for the root table
+// and the console).
+// Regions the table does not have are returned without
+// CBTABLE_REGION_PRESENT. CBTABLE_REGION_MAPPED tells whether the region
+// is mapped by an earlier read; this request only reads region headers
+// and leaves unmapped regions unmapped.
+//
+
+#define IOCTL_CBTABLE_QUERY_REGIONS \
+	CTL_CODE(FILE_DEVICE_UNKNOWN, 0x809, METHOD_OUT_DIRECT, FILE_READ_ACCESS)
+
+#define CBTABLE_REGION_PRESENT 0x1
+#define CBTABLE_REGION_MAPPED  0x2
+
+struct cbtable_region_info {
+	UINT32 region;		// enum NextRequest
+	UINT32 flags;
+	UINT64 address;
+	UINT64 bytes;
+	UINT32 entries;
+	UINT32 max_entries;
+};
+
+struct cbtable_regions {
+	UINT32 count;
+	UINT32 reserved;
+	struct cbtable_region_info regions[0];
+};
+
+//
+// IOCTL_CBTABLE_REPLAY_PCRS
+//
+// Output: struct cbtable_pcr_replay
+//
+// Replays the live TCPA log. cb_tcpa_replay from cbparse.h does the walk
+// here and in tools/cbpcr, which replays archived snapshot and TCPA files
+// on the host.
+//
+// Each PCR that has log entries is replayed from zero by extending it with
+// every logged digest in order, separately for SHA-1 and SHA-256 entries.
+// The bank is chosen by digest_length. Entries with another digest size
+// or a PCR index of CBTABLE_PCR_COUNT or above are only counted in
+// skipped. Values are ordered by algorithm, then PCR.
+//
+// If the output buffer cannot hold every value, only the header is
+// returned and the request fails with STATUS_BUFFER_OVERFLOW.
+//
+
+#define IOCTL_CBTABLE_REPLAY_PCRS \
+	CTL_CODE(FILE_DEVICE_UNKNOWN, 0x80A, METHOD_OUT_DIRECT, FILE_READ_ACCESS)
+
+#define CBTABLE_PCR_SHA1   0
+#define CBTABLE_PCR_SHA256 1
+#define CBTABLE_PCR_BANKS  2
+
+#define CBTABLE_PCR_COUNT 24
+#define CBTABLE_PCR_DIGEST_MAX 64
+
+struct cbtable_pcr_value {
+	UINT32 pcr;
+	UINT32 algorithm;	// CBTABLE_PCR_*
+	UINT32 digest_length;
+	UINT32 entries;		// log entries extended into this PCR
+	UINT8 digest[CBTABLE_PCR_DIGEST_MAX];
+};
+
+struct cbtable_pcr_replay {
+	UINT32 count;
+	UINT32 skipped;
+	struct cbtable_pcr_value pcrs[0];
+};
+
+//
+// IOCTL_CBTABLE_GET_MEMORY_MAP
+//
+// Output: struct cbtable_memory_map
+//
+// The LB_TAG_MEMORY ranges sorted by address, with overlaps clipped and
+// adjacent ranges of the same type merged, so every address falls in at
+// most one range. type is the coreboot LB_MEM_* value. cb_memory_classify
+// in cbparse.h looks addresses up in this array.
+//
+// If the output buffer cannot hold every range, only the header is
+// returned and the request fails with STATUS_BUFFER_OVERFLOW.
+//
+
+#define IOCTL_CBTABLE_GET_MEMORY_MAP \
+	CTL_CODE(FILE_DEVICE_UNKNOWN, 0x80B, METHOD_OUT_DIRECT, FILE_READ_ACCESS)
+
+struct cbtable_memory_range {
+	UINT64 start;
+	UINT64 end;		// exclusive
+	UINT32 type;
+	UINT32 reserved;
+};
+
+struct cbtable_memory_map {
+	UINT32 count;
+	UINT32 reserved;
+	struct cbtable_memory_range ranges[0];
+};
+
+//
+// IOCTL_CBTABLE_CLASSIFY_ADDRESSES
+//
+// Input:  array of UINT64 physical addresses
+// Output: array of UINT32 LB_MEM_* types, one per address, 0 for an
+//         address the memory map does not describe
+//
+
+#define IOCTL_CBTABLE_CLASSIFY_ADDRESSES \
+	CTL_CODE(FILE_DEVICE_UNKNOWN, 0x80C, METHOD_OUT_DIRECT, FILE_READ_ACCESS)
+
+//
+// IOCTL_CBTABLE_READ_OPTIONS
+//
+// Input:  struct cbtable_option_query, followed by count option names of
+//         CBTABLE_OPTION_NAME_MAX bytes each (NUL padded), followed by
+//         image_length bytes of CMOS image
+// Output: one struct cbtable_option_value per name, in the same order
+//
+// Values are decoded from the CMOS image in the request, or from the
+// table's LB_TAG_OPTION_DEFAULTS image when image_length is 0. value holds
+// fields of up to 64 bits; string options are returned in text instead,
+// as are the names of enum values. Unknown names come back without
+// CBTABLE_OPTION_FOUND.
+//
+
+#define IOCTL_CBTABLE_READ_OPTIONS \
+	CTL_CODE(FILE_DEVICE_UNKNOWN, 0x80D, METHOD_OUT_DIRECT, FILE_READ_ACCESS)
+
+#define CBTABLE_OPTION_NAME_MAX 32
+
+struct cbtable_option_query {
+	UINT32 count;
+	UINT32 image_length;
+};
+
+#define CBTABLE_OPTION_FOUND 0x1	// the table has the option
+#define CBTABLE_OPTION_VALUE 0x2	// value (or text for strings) is valid
+#define CBTABLE_OPTION_ENUM  0x4	// text names the enum value
+
+struct cbtable_option_value {
+	UINT32 flags;
+	UINT32 config;		// 'e', 'h', 's' or 'r'
+	UINT32 bit;
+	UINT32 length;		// in bits
+	UINT64 value;
+	char text[32];
+};
+
+//
+// IOCTL_CBTABLE_READ_CONSOLE_LINES
+//
+// Input:  struct cbtable_console_lines_request
+// Output: struct cbtable_console_lines, followed by length bytes of text
+//
+// Lines are counted in the console text as IOCTL_CBTABLE_READ_REGION
+// returns it, from 0. With stage set to a CBTABLE_STAGE_* value the lines
+// from that stage's banner up to the next stage's banner are returned and
+// first_line is ignored; otherwise lines from first_line on. line_count
+// limits the number of lines, 0 means no limit. Only whole lines are
+// returned, as many as fit in the output buffer; if not even one fits,
+// only the header is returned with STATUS_BUFFER_OVERFLOW.
+//
+// stage_lines gives the line each stage started on, CBTABLE_LINE_NONE if
+// it was not seen. If the console holds several boots, the last one wins.
+// A stage that was not seen fails the request with STATUS_NOT_FOUND.
+//
+
+#define IOCTL_CBTABLE_READ_CONSOLE_LINES \
+	CTL_CODE(FILE_DEVICE_UNKNOWN, 0x80E, METHOD_OUT_DIRECT, FILE_READ_ACCESS)
+
+#define CBTABLE_STAGE_BOOTBLOCK 1
+#define CBTABLE_STAGE_VERSTAGE  2
+#define CBTABLE_STAGE_ROMSTAGE  3
+#define CBTABLE_STAGE_POSTCAR   4
+#define CBTABLE_STAGE_RAMSTAGE  5
+#define CBTABLE_STAGE_PAYLOAD   6
+#define CBTABLE_STAGE_COUNT     7
+
+#define CBTABLE_LINE_NONE 0xffffffff
+
+struct cbtable_console_lines_request {
+	UINT32 stage;
+	UINT32 first_line;
+	UINT32 line_count;
+	UINT32 reserved;
+};
+
+struct cbtable_console_lines {
+	UINT32 first_line;
+	UINT32 line_count;
+	UINT32 total_lines;
+	UINT32 length;
+	UINT32 stage_lines[CBTABLE_STAGE_COUNT];
+	UINT32 reserved;
+};
+
+//
+// IOCTL_CBTABLE_GET_STATS
+//
+// Output: struct cbtable_stats
+//
+// Counters since the driver was loaded. regions is indexed by enum
+// NextRequest, with CBTABLE_STATS_CBMEM counting IOCTL_CBTABLE_READ_CBMEM.
+// latency[i] counts reads that took less than 2^i microseconds, the last
+// bucket every read slower than that. map_us and checksum_us are the total
+// time spent mapping the region and checksumming the table.
+//
+
+#define IOCTL_CBTABLE_GET_STATS \
+	CTL_CODE(FILE_DEVICE_UNKNOWN, 0x80F, METHOD_OUT_DIRECT, FILE_READ_ACCESS)
+
+#define CBTABLE_STATS_CBMEM     4
+#define CBTABLE_STATS_REGIONS   5
+#define CBTABLE_LATENCY_BUCKETS 16
+
+struct cbtable_region_stats {
+	UINT64 reads;
+	UINT64 bytes;
+	UINT64 maps;
+	UINT64 map_us;
+	UINT64 latency[CBTABLE_LATENCY_BUCKETS];
+};
+
+struct cbtable_stats {
+	UINT64 checksums;
+	UINT64 checksum_bytes;
+	UINT64 checksum_us;
+	struct cbtable_region_stats regions[CBTABLE_STATS_REGIONS];
+};
+
+//
+// IOCTL_CBTABLE_MAP_REGION
+//
+// Input:  UINT32 region id (enum NextRequest)
+// Output: struct cbtable_region_view
+//
+// Maps the region read-only into the calling process, so the console
+// cursor and the timestamps can be sampled without a request each time.
+// The view covers the whole region as mapped, bytes long. Readers go by
+// the console cursor and num_entries to find what is valid, as the driver
+// does. The caller needs SeSystemProfilePrivilege as well as read access.
+//
+// Only the pages holding the region are mapped, and only if the firmware
+// memory map (IOCTL_CBTABLE_GET_MEMORY_MAP) puts all of them in a single
+// LB_MEM_TABLE or LB_MEM_RESERVED range; otherwise the request fails with
+// STATUS_ACCESS_DENIED. The rest of the first and last page is visible,
+// but it is firmware memory too.
+//
+// A view stays mapped until the handle is closed or the process exits,
+// whichever comes first; it can't be unmapped on its own. Mapping the
+// same region again from the same process and handle returns the same
+// view. A process holds at most CBTABLE_VIEWS_PER_PROCESS views across
+// all handles, beyond which requests fail with STATUS_QUOTA_EXCEEDED.
+// STATUS_NOT_SUPPORTED means the driver could not register for process
+// exit and hands out no views.
+//
+
+#define IOCTL_CBTABLE_MAP_REGION \
+	CTL_CODE(FILE_DEVICE_UNKNOWN, 0x810, METHOD_OUT_DIRECT, FILE_READ_ACCESS)
+
+#define CBTABLE_VIEWS_PER_PROCESS 8
+
+struct cbtable_region_view {
+	UINT64 address;		// in the caller's address space
+	UINT64 bytes;
+	UINT64 physical;
+	UINT32 region;
+	UINT32 reserved;
+};
+
+#endif
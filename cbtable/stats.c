@@ -0,0 +1,89 @@
+#include "driver.h"
+
+//
+// Per-region counters. Updated with interlocked adds from requests that
+// run concurrently under the shared region lock, and read without a lock,
+// so a snapshot may be a few updates apart between fields.
+//
+
+static LONGLONG ticksPerSecond;
+
+VOID CBTableStatsInit(VOID) {
+	LARGE_INTEGER frequency;
+
+	KeQueryPerformanceCounter(&frequency);
+	ticksPerSecond = frequency.QuadPart;
+}
+
+UINT64 CBTableStatsStart(VOID) {
+	return (UINT64)KeQueryPerformanceCounter(NULL).QuadPart;
+}
+
+static UINT64 elapsedUs(UINT64 start) {
+	UINT64 ticks = CBTableStatsStart() - start;
+
+	if (!ticksPerSecond)
+		return 0;
+	return ticks * 1000000 / (UINT64)ticksPerSecond;
+}
+
+/* bucket i counts latencies below 2^i us, the last one everything above */
+static UINT32 latencyBucket(UINT64 us) {
+	UINT32 bucket = 0;
+
+	while (bucket < CBTABLE_LATENCY_BUCKETS - 1 && us >= (1ull << bucket))
+		bucket++;
+	return bucket;
+}
+
+VOID CBTableStatsRead(PCBTABLE_CONTEXT pDevice, UINT32 region, size_t bytes, UINT64 start) {
+	CBTABLE_REGION_STATS* stats = &pDevice->stats.regions[region];
+	UINT64 us = elapsedUs(start);
+
+	InterlockedIncrement64(&stats->reads);
+	InterlockedAdd64(&stats->bytes, (LONG64)bytes);
+	InterlockedIncrement64(&stats->latency[latencyBucket(us)]);
+}
+
+VOID CBTableStatsMap(PCBTABLE_CONTEXT pDevice, UINT32 region, UINT64 start) {
+	CBTABLE_REGION_STATS* stats = &pDevice->stats.regions[region];
+
+	InterlockedIncrement64(&stats->maps);
+	InterlockedAdd64(&stats->mapUs, (LONG64)elapsedUs(start));
+}
+
+VOID CBTableStatsChecksum(PCBTABLE_CONTEXT pDevice, size_t bytes, UINT64 start) {
+	InterlockedIncrement64(&pDevice->stats.checksums);
+	InterlockedAdd64(&pDevice->stats.checksumBytes, (LONG64)bytes);
+	InterlockedAdd64(&pDevice->stats.checksumUs, (LONG64)elapsedUs(start));
+}
+
+NTSTATUS CBTableGetStats(PCBTABLE_CONTEXT pDevice, PVOID Buffer, size_t BufLen, size_t *BytesCopied) {
+	struct cbtable_stats* out = Buffer;
+
+	*BytesCopied = 0;
+
+	if (BufLen < sizeof(*out))
+		return STATUS_BUFFER_TOO_SMALL;
+
+	RtlZeroMemory(out, sizeof(*out));
+	out->checksums = ReadLong64NoFence(&pDevice->stats.checksums);
+	out->checksum_bytes = ReadLong64NoFence(&pDevice->stats.checksumBytes);
+	out->checksum_us = ReadLong64NoFence(&pDevice->stats.checksumUs);
+
+	for (UINT32 region = 0; region < CBTABLE_STATS_REGIONS; region++) {
+		CBTABLE_REGION_STATS* stats = &pDevice->stats.regions[region];
+		struct cbtable_region_stats* regionOut = &out->regions[region];
+
+		regionOut->reads = ReadLong64NoFence(&stats->reads);
+		regionOut->bytes = ReadLong64NoFence(&stats->bytes);
+		regionOut->maps = ReadLong64NoFence(&stats->maps);
+		regionOut->map_us = ReadLong64NoFence(&stats->mapUs);
+
+		for (UINT32 bucket = 0; bucket < CBTABLE_LATENCY_BUCKETS; bucket++)
+			regionOut->latency[bucket] = ReadLong64NoFence(&stats->latency[bucket]);
+	}
+
+	*BytesCopied = sizeof(*out);
+	return STATUS_SUCCESS;
+}
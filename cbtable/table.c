@@ -0,0 +1,886 @@
+#include "driver.h"
+#include "table.tmh"
+
+//
+// Parsing of the coreboot table and the lifetime of the region mappings.
+//
+// Nothing is parsed or mapped when the device starts. The first request
+// maps the table, validates it and builds the tag index; each region is
+// mapped the first time it is read. Once the device has gone
+// CBTABLE_IDLE_UNMAP_MS without a request, everything is unmapped again
+// and rebuilt by the next request.
+//
+// regionLock is held shared while a request reads from a mapping, and
+// exclusive while mappings are created or torn down.
+//
+
+/*
+ * word sum for the ip checksum (16 bit quantities) of a passed in buffer.
+ * In case the buffer length is odd last byte is excluded from the calculation
+ */
+static UINT32 sumWords(const void* addr, unsigned size)
+{
+#if defined(_M_AMD64)
+	return cb_sum_words_sse2(addr, size);
+#else
+	return cb_sum_words(addr, size);
+#endif
+}
+
+static void unmapRegion(MemMapping* mapping) {
+	if (mapping->mapped) {
+		MmUnmapIoSpace(mapping->virtAddr, mapping->sz);
+	}
+
+	mapping->virtAddr = NULL;
+	mapping->sz = 0;
+	mapping->mapped = FALSE;
+}
+
+static void mapFixed(MemMapping* mapping) {
+	if (!mapping->sz)
+		return;
+
+	mapping->virtAddr = MmMapIoSpace(mapping->physAddr, mapping->sz, MmCached);
+	if (mapping->virtAddr)
+		mapping->mapped = TRUE;
+}
+
+static void mapConsole(MemMapping* mapping) {
+	struct cbmem_console* console_p;
+	size_t size;
+
+	size = sizeof(*console_p);
+
+	size_t lastMapping = size;
+	console_p = MmMapIoSpace(mapping->physAddr, lastMapping, MmCached);
+	if (!console_p)
+		return;
+
+	//
+	// Map the whole buffer rather than up to the current cursor, so text
+	// appended after the first read is still visible to readers.
+	//
+	size = console_p->size;
+	MmUnmapIoSpace(console_p, lastMapping);
+
+	lastMapping = size + sizeof(*console_p);
+	console_p = MmMapIoSpace(mapping->physAddr, lastMapping, MmCached);
+	if (!console_p)
+		return;
+
+	mapping->virtAddr = console_p;
+	mapping->sz = lastMapping;
+	mapping->mapped = TRUE;
+}
+
+static void mapTimestamps(MemMapping* mapping) {
+	struct timestamp_table* timestamp_p;
+	size_t size;
+
+	size = sizeof(*timestamp_p);
+
+	size_t lastMapping = size;
+	timestamp_p = MmMapIoSpace(mapping->physAddr, lastMapping, MmCached);
+	if (!timestamp_p)
+		return;
+
+	//
+	// Map room for max_entries so stamps added later (payload, OS loader)
+	// are covered without remapping.
+	//
+	size += max(timestamp_p->max_entries, timestamp_p->num_entries) * sizeof(timestamp_p->entries[0]);
+	MmUnmapIoSpace(timestamp_p, lastMapping);
+
+	lastMapping = size;
+	timestamp_p = MmMapIoSpace(mapping->physAddr, lastMapping, MmCached);
+	if (!timestamp_p)
+		return;
+
+	mapping->virtAddr = timestamp_p;
+	mapping->sz = lastMapping;
+	mapping->mapped = TRUE;
+}
+
+static void mapTcpa(MemMapping* mapping) {
+	struct tcpa_table* tcpa_p;
+	size_t size;
+
+	size = sizeof(*tcpa_p);
+
+	size_t lastMapping = size;
+	tcpa_p = MmMapIoSpace(mapping->physAddr, lastMapping, MmCached);
+	if (!tcpa_p)
+		return;
+
+	//
+	// Likewise, leave room for measurements logged after the first read
+	//
+	size += max(tcpa_p->max_entries, tcpa_p->num_entries) * sizeof(tcpa_p->entries[0]);
+	MmUnmapIoSpace(tcpa_p, lastMapping);
+
+	lastMapping = size;
+	tcpa_p = MmMapIoSpace(mapping->physAddr, lastMapping, MmCached);
+	if (!tcpa_p)
+		return;
+
+	mapping->virtAddr = tcpa_p;
+	mapping->sz = lastMapping;
+	mapping->mapped = TRUE;
+}
+
+/*
+ * check signature, bounds and checksum of a coreboot table mapped with
+ * size bytes available
+ */
+static BOOLEAN validateTable(PCBTABLE_CONTEXT pDevice, struct coreboot_table_header* hdr, size_t size) {
+	if (!cb_table_header(hdr, size)) {
+		CBTablePrint(DEBUG_LEVEL_ERROR, DBG_TABLE, "Invalid coreboot table\n");
+		return FALSE;
+	}
+
+	UINT64 start = CBTableStatsStart();
+	UINT32 sum = sumWords((UINT8*)hdr + hdr->header_bytes, hdr->table_bytes);
+	CBTableStatsChecksum(pDevice, hdr->table_bytes, start);
+
+	if (!cb_table_checksum_ok(hdr, sum)) {
+		CBTablePrint(DEBUG_LEVEL_ERROR, DBG_TABLE, "Invalid cbmem checksum 0x%x vs 0x%x\n", hdr->table_checksum, cb_fold_checksum(sum));
+		return FALSE;
+	}
+
+	return TRUE;
+}
+
+/*
+ * calls fn for every well-formed entry of the table
+ */
+typedef void (*TableEntryCallback)(PVOID context, struct coreboot_table_entry* entry);
+
+static void walkTable(struct coreboot_table_header* hdr, TableEntryCallback fn, PVOID context) {
+	struct cb_entry_iter it;
+	struct coreboot_table_entry* entry;
+
+	cb_for_each_entry(entry, it, hdr)
+		fn(context, entry);
+}
+
+static void countEntry(PVOID context, struct coreboot_table_entry* entry) {
+	PCBTABLE_CONTEXT pDevice = context;
+
+	if (entry->tag < CBTABLE_TAG_COUNT)
+		pDevice->tagIndex[entry->tag].count++;
+}
+
+static void indexEntry(PVOID context, struct coreboot_table_entry* entry) {
+	PCBTABLE_CONTEXT pDevice = context;
+
+	if (entry->tag < CBTABLE_TAG_COUNT) {
+		CBTABLE_TAG_INDEX* index = &pDevice->tagIndex[entry->tag];
+		pDevice->tagEntries[index->first + index->count++] = entry;
+	}
+}
+
+static void mapForward(PCBTABLE_CONTEXT pDevice, struct lb_forward* forward) {
+	struct coreboot_table_header* hdr;
+	size_t size;
+
+	CBTablePrint(DEBUG_LEVEL_INFO, DBG_TABLE, "Following coreboot table forward to 0x%llx\n", forward->forward);
+
+	pDevice->forwardMapping.physAddr.QuadPart = forward->forward;
+
+	size = sizeof(*hdr);
+	hdr = MmMapIoSpace(pDevice->forwardMapping.physAddr, size, MmCached);
+	if (!hdr)
+		return;
+
+	size = (size_t)hdr->header_bytes + hdr->table_bytes;
+	MmUnmapIoSpace(hdr, sizeof(*hdr));
+
+	if (size < sizeof(*hdr))
+		return;
+
+	hdr = MmMapIoSpace(pDevice->forwardMapping.physAddr, size, MmCached);
+	if (!hdr)
+		return;
+
+	pDevice->forwardMapping.virtAddr = hdr;
+	pDevice->forwardMapping.sz = size;
+	pDevice->forwardMapping.mapped = TRUE;
+
+	if (!validateTable(pDevice, hdr, size))
+		unmapRegion(&pDevice->forwardMapping);
+}
+
+/*
+ * group the entries of the root table, and of the table it forwards to,
+ * by tag so lookups don't need to walk the table again
+ */
+static NTSTATUS buildTagIndex(PCBTABLE_CONTEXT pDevice) {
+	struct coreboot_table_header* tables[2];
+	UINT32 tableCount = 0;
+	UINT32 entryCount = 0;
+
+	RtlZeroMemory(pDevice->tagIndex, sizeof(pDevice->tagIndex));
+
+	tables[tableCount++] = pDevice->rootMapping.virtAddr;
+
+	//
+	// Only the first forward is followed; coreboot uses a single hop from
+	// the low table to the real one in CBMEM.
+	//
+	struct lb_forward* forward = CB_ENTRY_VIEW(cb_find_entry(tables[0], LB_TAG_FORWARD), struct lb_forward);
+	if (forward) {
+		mapForward(pDevice, forward);
+		if (pDevice->forwardMapping.mapped)
+			tables[tableCount++] = pDevice->forwardMapping.virtAddr;
+	}
+
+	for (UINT32 i = 0; i < tableCount; i++)
+		walkTable(tables[i], countEntry, pDevice);
+
+	for (UINT32 tag = 0; tag < CBTABLE_TAG_COUNT; tag++) {
+		pDevice->tagIndex[tag].first = entryCount;
+		entryCount += pDevice->tagIndex[tag].count;
+		pDevice->tagIndex[tag].count = 0;
+	}
+
+	if (!entryCount)
+		return STATUS_SUCCESS;
+
+	pDevice->tagEntries = ExAllocatePoolWithTag(NonPagedPoolNx, entryCount * sizeof(pDevice->tagEntries[0]), CBTABLE_POOL_TAG);
+	if (!pDevice->tagEntries)
+		return STATUS_INSUFFICIENT_RESOURCES;
+
+	for (UINT32 i = 0; i < tableCount; i++)
+		walkTable(tables[i], indexEntry, pDevice);
+
+	pDevice->entryCount = entryCount;
+	return STATUS_SUCCESS;
+}
+
+/*
+ * record where every CBMEM entry lives without mapping any of them
+ */
+static NTSTATUS buildCbmemDirectory(PCBTABLE_CONTEXT pDevice) {
+	UINT32 count = pDevice->tagIndex[LB_TAG_CBMEM_ENTRY].count;
+
+	if (!count)
+		return STATUS_SUCCESS;
+
+	pDevice->cbmemMappings = ExAllocatePoolWithTag(NonPagedPoolNx, count * sizeof(pDevice->cbmemMappings[0]), CBTABLE_POOL_TAG);
+	if (!pDevice->cbmemMappings)
+		return STATUS_INSUFFICIENT_RESOURCES;
+
+	RtlZeroMemory(pDevice->cbmemMappings, count * sizeof(pDevice->cbmemMappings[0]));
+
+	for (UINT32 i = 0; i < count; i++) {
+		struct lb_cbmem_entry* entry = CB_ENTRY_VIEW(CBTableGetEntry(pDevice, LB_TAG_CBMEM_ENTRY, i), struct lb_cbmem_entry);
+		if (!entry)
+			continue;
+
+		pDevice->cbmemMappings[i].physAddr.QuadPart = entry->address;
+		pDevice->cbmemMappings[i].sz = entry->entry_size;
+	}
+
+	return STATUS_SUCCESS;
+}
+
+static NTSTATUS buildMemoryMap(PCBTABLE_CONTEXT pDevice) {
+	struct lb_memory* mem = CB_ENTRY_VIEW(CBTableGetEntry(pDevice, LB_TAG_MEMORY, 0), struct lb_memory);
+	UINT32 count;
+
+	if (!mem)
+		return STATUS_SUCCESS;
+
+	count = cb_memory_range_count(mem);
+	if (!count)
+		return STATUS_SUCCESS;
+
+	pDevice->memoryRanges = ExAllocatePoolWithTag(NonPagedPoolNx, count * sizeof(pDevice->memoryRanges[0]), CBTABLE_POOL_TAG);
+	if (!pDevice->memoryRanges)
+		return STATUS_INSUFFICIENT_RESOURCES;
+
+	pDevice->memoryRangeCount = cb_memory_build(mem, pDevice->memoryRanges);
+	return STATUS_SUCCESS;
+}
+
+static NTSTATUS buildOptionIndex(PCBTABLE_CONTEXT pDevice) {
+	struct cmos_option_table* table = CB_ENTRY_VIEW(CBTableGetEntry(pDevice, LB_TAG_CMOS_OPTION_TABLE, 0), struct cmos_option_table);
+	UINT32 count;
+
+	if (!table)
+		return STATUS_SUCCESS;
+
+	pDevice->optionTable = table;
+
+	count = cb_option_count(table);
+	if (!count)
+		return STATUS_SUCCESS;
+
+	pDevice->optionIndex = ExAllocatePoolWithTag(NonPagedPoolNx, count * sizeof(pDevice->optionIndex[0]), CBTABLE_POOL_TAG);
+	if (!pDevice->optionIndex)
+		return STATUS_INSUFFICIENT_RESOURCES;
+
+	pDevice->optionCount = cb_option_index(table, pDevice->optionIndex);
+	return STATUS_SUCCESS;
+}
+
+static void locateRegion(PCBTABLE_CONTEXT pDevice, UINT32 tag, MemMapping* mapping) {
+	struct lb_cbmem_ref* ref = CB_ENTRY_VIEW(CBTableGetEntry(pDevice, tag, 0), struct lb_cbmem_ref);
+
+	if (ref) {
+		CBTablePrint(DEBUG_LEVEL_INFO, DBG_TABLE, "Found cbmem tag 0x%x at 0x%llx\n", tag, ref->cbmem_addr);
+
+		mapping->physAddr.QuadPart = ref->cbmem_addr;
+	}
+}
+
+/*
+ * unmap every region and drop the index. Called with regionLock held
+ * exclusive, or when no request can be running.
+ */
+static void releaseTable(PCBTABLE_CONTEXT pDevice) {
+	if (pDevice->cbmemMappings) {
+		for (UINT32 i = 0; i < pDevice->tagIndex[LB_TAG_CBMEM_ENTRY].count; i++)
+			unmapRegion(&pDevice->cbmemMappings[i]);
+
+		ExFreePoolWithTag(pDevice->cbmemMappings, CBTABLE_POOL_TAG);
+		pDevice->cbmemMappings = NULL;
+	}
+
+	CBTableFreeLineIndex(pDevice);
+
+	if (pDevice->optionIndex) {
+		ExFreePoolWithTag(pDevice->optionIndex, CBTABLE_POOL_TAG);
+		pDevice->optionIndex = NULL;
+	}
+	pDevice->optionCount = 0;
+	pDevice->optionTable = NULL;
+
+	if (pDevice->memoryRanges) {
+		ExFreePoolWithTag(pDevice->memoryRanges, CBTABLE_POOL_TAG);
+		pDevice->memoryRanges = NULL;
+	}
+	pDevice->memoryRangeCount = 0;
+
+	if (pDevice->tagEntries) {
+		ExFreePoolWithTag(pDevice->tagEntries, CBTABLE_POOL_TAG);
+		pDevice->tagEntries = NULL;
+	}
+
+	RtlZeroMemory(pDevice->tagIndex, sizeof(pDevice->tagIndex));
+	pDevice->entryCount = 0;
+
+	unmapRegion(&pDevice->consoleMapping);
+	unmapRegion(&pDevice->timestampMapping);
+	unmapRegion(&pDevice->tcpaMapping);
+	RtlZeroMemory(&pDevice->consoleMapping.physAddr, sizeof(PHYSICAL_ADDRESS));
+	RtlZeroMemory(&pDevice->timestampMapping.physAddr, sizeof(PHYSICAL_ADDRESS));
+	RtlZeroMemory(&pDevice->tcpaMapping.physAddr, sizeof(PHYSICAL_ADDRESS));
+
+	unmapRegion(&pDevice->forwardMapping);
+
+	//
+	// The root mapping's size comes from the ACPI resource, keep it
+	//
+	if (pDevice->rootMapping.mapped) {
+		MmUnmapIoSpace(pDevice->rootMapping.virtAddr, pDevice->rootMapping.sz);
+		pDevice->rootMapping.virtAddr = NULL;
+		pDevice->rootMapping.mapped = FALSE;
+	}
+
+	pDevice->parsed = FALSE;
+}
+
+/*
+ * map and validate the table, then build the index. Called with
+ * regionLock held exclusive.
+ */
+static NTSTATUS parseTable(PCBTABLE_CONTEXT pDevice) {
+	NTSTATUS status;
+
+	if (!pDevice->rootMapping.sz)
+		return STATUS_DEVICE_NOT_READY;
+
+	UINT64 start = CBTableStatsStart();
+	mapFixed(&pDevice->rootMapping);
+	if (!pDevice->rootMapping.mapped)
+		return STATUS_INSUFFICIENT_RESOURCES;
+
+	CBTableStatsMap(pDevice, NextRequestRoot, start);
+
+	if (!validateTable(pDevice, pDevice->rootMapping.virtAddr, pDevice->rootMapping.sz)) {
+		status = STATUS_INVALID_DEVICE_STATE;
+		goto fail;
+	}
+
+	status = buildTagIndex(pDevice);
+	if (!NT_SUCCESS(status))
+		goto fail;
+
+	status = buildCbmemDirectory(pDevice);
+	if (!NT_SUCCESS(status))
+		goto fail;
+
+	status = buildMemoryMap(pDevice);
+	if (!NT_SUCCESS(status))
+		goto fail;
+
+	status = buildOptionIndex(pDevice);
+	if (!NT_SUCCESS(status))
+		goto fail;
+
+	locateRegion(pDevice, LB_TAG_CBMEM_CONSOLE, &pDevice->consoleMapping);
+	locateRegion(pDevice, LB_TAG_TIMESTAMPS, &pDevice->timestampMapping);
+	locateRegion(pDevice, LB_TAG_TCPA_LOG, &pDevice->tcpaMapping);
+
+	pDevice->parsed = TRUE;
+
+	WdfTimerStart(pDevice->idleTimer, WDF_REL_TIMEOUT_IN_MS(CBTABLE_IDLE_UNMAP_MS));
+	return STATUS_SUCCESS;
+
+fail:
+	releaseTable(pDevice);
+	return status;
+}
+
+static void acquireExclusive(PCBTABLE_CONTEXT pDevice) {
+	KeEnterCriticalRegion();
+	ExAcquireResourceExclusiveLite(&pDevice->regionLock, TRUE);
+}
+
+struct coreboot_table_entry* CBTableGetEntry(PCBTABLE_CONTEXT pDevice, UINT32 tag, UINT32 instance) {
+	if (!pDevice->tagEntries || tag >= CBTABLE_TAG_COUNT)
+		return NULL;
+
+	if (instance >= pDevice->tagIndex[tag].count)
+		return NULL;
+
+	return pDevice->tagEntries[pDevice->tagIndex[tag].first + instance];
+}
+
+NTSTATUS CBTableAcquire(PCBTABLE_CONTEXT pDevice) {
+	NTSTATUS status = STATUS_SUCCESS;
+
+	KeEnterCriticalRegion();
+	ExAcquireResourceSharedLite(&pDevice->regionLock, TRUE);
+
+	if (!pDevice->parsed) {
+		ExReleaseResourceLite(&pDevice->regionLock);
+		ExAcquireResourceExclusiveLite(&pDevice->regionLock, TRUE);
+
+		if (!pDevice->parsed)
+			status = parseTable(pDevice);
+
+		if (!NT_SUCCESS(status)) {
+			CBTableRelease(pDevice);
+			return status;
+		}
+
+		ExConvertExclusiveToSharedLite(&pDevice->regionLock);
+	}
+
+	InterlockedExchange64(&pDevice->lastAccess, (LONG64)KeQueryInterruptTime());
+	return status;
+}
+
+VOID CBTableRelease(PCBTABLE_CONTEXT pDevice) {
+	ExReleaseResourceLite(&pDevice->regionLock);
+	KeLeaveCriticalRegion();
+}
+
+static MemMapping* resolveRegion(PCBTABLE_CONTEXT pDevice, UINT32 region) {
+	MemMapping* mapping;
+
+	switch (region) {
+	case NextRequestRoot:
+		return &pDevice->rootMapping;
+	case NextRequestTcpa:
+		mapping = &pDevice->tcpaMapping;
+		break;
+	case NextRequestTimestamps:
+		mapping = &pDevice->timestampMapping;
+		break;
+	case NextRequestConsole:
+	default:
+		mapping = &pDevice->consoleMapping;
+		break;
+	}
+
+	if (!mapping->physAddr.QuadPart)
+		return NULL;
+	return mapping;
+}
+
+/*
+ * true once the firmware has logged more entries than the mapping was
+ * sized for, which only happens if num_entries went past max_entries
+ */
+static BOOLEAN regionOutgrown(PCBTABLE_CONTEXT pDevice, MemMapping* mapping) {
+	if (mapping == &pDevice->timestampMapping) {
+		struct timestamp_table* timestamp_p = mapping->virtAddr;
+		return cb_timestamp_count(timestamp_p, mapping->sz) < timestamp_p->num_entries;
+	}
+
+	if (mapping == &pDevice->tcpaMapping) {
+		struct tcpa_table* tcpa_p = mapping->virtAddr;
+		return cb_tcpa_count(tcpa_p, mapping->sz) < tcpa_p->num_entries;
+	}
+
+	return FALSE;
+}
+
+/*
+ * bytes of the header map* reads first to size a region
+ */
+static size_t regionHeaderSize(UINT32 region) {
+	switch (region) {
+	case NextRequestTcpa:
+		return sizeof(struct tcpa_table);
+	case NextRequestTimestamps:
+		return sizeof(struct timestamp_table);
+	case NextRequestConsole:
+	default:
+		return sizeof(struct cbmem_console);
+	}
+}
+
+/*
+ * bytes map* would map for a region, from its header alone
+ */
+static size_t regionFullSize(UINT32 region, PVOID header) {
+	switch (region) {
+	case NextRequestTcpa: {
+		struct tcpa_table* tcpa_p = header;
+		return sizeof(*tcpa_p) + max(tcpa_p->max_entries, tcpa_p->num_entries) * sizeof(tcpa_p->entries[0]);
+	}
+	case NextRequestTimestamps: {
+		struct timestamp_table* timestamp_p = header;
+		return sizeof(*timestamp_p) + max(timestamp_p->max_entries, timestamp_p->num_entries) * sizeof(timestamp_p->entries[0]);
+	}
+	case NextRequestConsole:
+	default: {
+		struct cbmem_console* console_p = header;
+		return sizeof(*console_p) + console_p->size;
+	}
+	}
+}
+
+/*
+ * sizes and counts of a region. Only its header is read, so size may be
+ * that of the full region while only the header is mapped.
+ */
+static void describeRegion(UINT32 region, PVOID image, size_t size, struct cbtable_region_info* info) {
+	info->bytes = cb_region_length(region, image, size);
+
+	switch (region) {
+	case NextRequestRoot: {
+		struct coreboot_table_header* hdr = image;
+		info->entries = hdr->table_entries;
+		break;
+	}
+	case NextRequestTimestamps: {
+		struct timestamp_table* timestamp_p = image;
+		info->entries = cb_timestamp_count(timestamp_p, size);
+		info->max_entries = timestamp_p->max_entries;
+		break;
+	}
+	case NextRequestTcpa: {
+		struct tcpa_table* tcpa_p = image;
+		info->entries = cb_tcpa_count(tcpa_p, size);
+		info->max_entries = tcpa_p->max_entries;
+		break;
+	}
+	default:
+		break;
+	}
+}
+
+/*
+ * fills info for one region without mapping it. A region that is not
+ * mapped yet is described through a temporary mapping of its header,
+ * the way mapConsole sizes the console, and stays unmapped.
+ */
+NTSTATUS CBTableQueryRegion(PCBTABLE_CONTEXT pDevice, enum NextRequest region, struct cbtable_region_info* info) {
+	MemMapping* mapping;
+	PVOID header;
+	size_t headerSize;
+	NTSTATUS status;
+
+	status = CBTableAcquire(pDevice);
+	if (!NT_SUCCESS(status))
+		return status;
+
+	mapping = resolveRegion(pDevice, region);
+	if (!mapping) {
+		status = STATUS_DEVICE_NOT_READY;
+		goto exit;
+	}
+
+	info->flags = CBTABLE_REGION_PRESENT;
+	info->address = mapping->physAddr.QuadPart;
+
+	if (mapping->mapped) {
+		info->flags |= CBTABLE_REGION_MAPPED;
+
+		//
+		// An outgrown mapping is replaced on the next read, so report
+		// what that read will see
+		//
+		if (regionOutgrown(pDevice, mapping))
+			describeRegion(region, mapping->virtAddr, regionFullSize(region, mapping->virtAddr), info);
+		else
+			describeRegion(region, mapping->virtAddr, mapping->sz, info);
+		goto exit;
+	}
+
+	headerSize = regionHeaderSize(region);
+	header = MmMapIoSpace(mapping->physAddr, headerSize, MmCached);
+	if (!header) {
+		status = STATUS_INSUFFICIENT_RESOURCES;
+		goto exit;
+	}
+
+	describeRegion(region, header, regionFullSize(region, header), info);
+	MmUnmapIoSpace(header, headerSize);
+
+exit:
+	CBTableRelease(pDevice);
+	return status;
+}
+
+static void mapRegion(PCBTABLE_CONTEXT pDevice, UINT32 region, MemMapping* mapping) {
+	if (mapping->mapped && regionOutgrown(pDevice, mapping))
+		unmapRegion(mapping);
+
+	if (mapping->mapped)
+		return;
+
+	UINT64 start = CBTableStatsStart();
+
+	switch (region) {
+	case NextRequestTcpa:
+		mapTcpa(mapping);
+		break;
+	case NextRequestTimestamps:
+		mapTimestamps(mapping);
+		break;
+	case NextRequestConsole:
+		mapConsole(mapping);
+		break;
+	default:
+		break;
+	}
+
+	if (mapping->mapped)
+		CBTableStatsMap(pDevice, region, start);
+}
+
+static MemMapping* resolveCbmem(PCBTABLE_CONTEXT pDevice, UINT32 id) {
+	UINT32 count = pDevice->tagIndex[LB_TAG_CBMEM_ENTRY].count;
+
+	if (!pDevice->cbmemMappings)
+		return NULL;
+
+	for (UINT32 i = 0; i < count; i++) {
+		struct lb_cbmem_entry* entry = CB_ENTRY_VIEW(CBTableGetEntry(pDevice, LB_TAG_CBMEM_ENTRY, i), struct lb_cbmem_entry);
+		if (entry && entry->id == id)
+			return &pDevice->cbmemMappings[i];
+	}
+
+	return NULL;
+}
+
+static void mapCbmem(PCBTABLE_CONTEXT pDevice, UINT32 id, MemMapping* mapping) {
+	UNREFERENCED_PARAMETER(id);
+
+	if (mapping->mapped)
+		return;
+
+	UINT64 start = CBTableStatsStart();
+
+	mapFixed(mapping);
+	if (mapping->mapped)
+		CBTableStatsMap(pDevice, CBTABLE_STATS_CBMEM, start);
+}
+
+typedef MemMapping* (*RegionResolver)(PCBTABLE_CONTEXT pDevice, UINT32 key);
+typedef void (*RegionMapper)(PCBTABLE_CONTEXT pDevice, UINT32 key, MemMapping* mapping);
+
+/*
+ * like CBTableAcquire, but also makes sure the mapping found by resolve is
+ * mapped before returning it
+ */
+static NTSTATUS acquireMapping(PCBTABLE_CONTEXT pDevice, RegionResolver resolve, RegionMapper map, UINT32 key, MemMapping** mapping) {
+	NTSTATUS status;
+
+	status = CBTableAcquire(pDevice);
+	if (!NT_SUCCESS(status))
+		return status;
+
+	*mapping = resolve(pDevice, key);
+	if (*mapping && (*mapping)->mapped && !regionOutgrown(pDevice, *mapping))
+		return STATUS_SUCCESS;
+
+	CBTableRelease(pDevice);
+	acquireExclusive(pDevice);
+
+	status = STATUS_SUCCESS;
+	if (!pDevice->parsed)
+		status = parseTable(pDevice);
+
+	if (NT_SUCCESS(status)) {
+		*mapping = resolve(pDevice, key);
+		if (!*mapping) {
+			status = STATUS_NOT_FOUND;
+		}
+		else {
+			map(pDevice, key, *mapping);
+			if (!(*mapping)->mapped)
+				status = STATUS_INSUFFICIENT_RESOURCES;
+		}
+	}
+
+	if (!NT_SUCCESS(status)) {
+		CBTableRelease(pDevice);
+		return status;
+	}
+
+	ExConvertExclusiveToSharedLite(&pDevice->regionLock);
+	InterlockedExchange64(&pDevice->lastAccess, (LONG64)KeQueryInterruptTime());
+	return STATUS_SUCCESS;
+}
+
+NTSTATUS CBTableAcquireRegion(PCBTABLE_CONTEXT pDevice, enum NextRequest region, MemMapping** mapping) {
+	NTSTATUS status = acquireMapping(pDevice, resolveRegion, mapRegion, region, mapping);
+
+	if (status == STATUS_NOT_FOUND) {
+		CBTablePrint(DEBUG_LEVEL_INFO, DBG_TABLE, "Requested mapping not present\n");
+		status = STATUS_DEVICE_NOT_READY;
+	}
+	return status;
+}
+
+NTSTATUS CBTableAcquireCbmem(PCBTABLE_CONTEXT pDevice, UINT32 id, MemMapping** mapping) {
+	return acquireMapping(pDevice, resolveCbmem, mapCbmem, id, mapping);
+}
+
+/*
+ * true if every region present in the table is mapped and current
+ */
+static BOOLEAN regionsMapped(PCBTABLE_CONTEXT pDevice) {
+	for (UINT32 region = 0; region < NextRequestReserved; region++) {
+		MemMapping* mapping = resolveRegion(pDevice, region);
+
+		if (mapping && (!mapping->mapped || regionOutgrown(pDevice, mapping)))
+			return FALSE;
+	}
+
+	return TRUE;
+}
+
+/*
+ * like CBTableAcquire, but also maps every region present in the table so
+ * the caller can read all of them, through CBTableGetRegion, under a single
+ * hold of regionLock
+ */
+NTSTATUS CBTableAcquireAllRegions(PCBTABLE_CONTEXT pDevice) {
+	NTSTATUS status;
+
+	status = CBTableAcquire(pDevice);
+	if (!NT_SUCCESS(status))
+		return status;
+
+	if (regionsMapped(pDevice))
+		return STATUS_SUCCESS;
+
+	CBTableRelease(pDevice);
+	acquireExclusive(pDevice);
+
+	status = STATUS_SUCCESS;
+	if (!pDevice->parsed)
+		status = parseTable(pDevice);
+
+	for (UINT32 region = 0; NT_SUCCESS(status) && region < NextRequestReserved; region++) {
+		MemMapping* mapping = resolveRegion(pDevice, region);
+
+		if (!mapping)
+			continue;
+
+		mapRegion(pDevice, region, mapping);
+		if (!mapping->mapped)
+			status = STATUS_INSUFFICIENT_RESOURCES;
+	}
+
+	if (!NT_SUCCESS(status)) {
+		CBTableRelease(pDevice);
+		return status;
+	}
+
+	ExConvertExclusiveToSharedLite(&pDevice->regionLock);
+	InterlockedExchange64(&pDevice->lastAccess, (LONG64)KeQueryInterruptTime());
+	return STATUS_SUCCESS;
+}
+
+/*
+ * mapping of a region, or of the table the root forwards to for
+ * CBTABLE_SNAPSHOT_FORWARD. regionLock must be held; NULL if the region is
+ * not mapped.
+ */
+MemMapping* CBTableGetRegion(PCBTABLE_CONTEXT pDevice, UINT32 region) {
+	MemMapping* mapping = NULL;
+
+	if (region == CBTABLE_SNAPSHOT_FORWARD)
+		mapping = &pDevice->forwardMapping;
+	else if (region < NextRequestReserved)
+		mapping = resolveRegion(pDevice, region);
+
+	return mapping && mapping->mapped ? mapping : NULL;
+}
+
+VOID CBTableReleaseAll(PCBTABLE_CONTEXT pDevice) {
+	acquireExclusive(pDevice);
+	releaseTable(pDevice);
+	CBTableRelease(pDevice);
+}
+
+VOID
+CBTableIdleTimer(
+	_In_  WDFTIMER  Timer
+)
+/*++
+  Routine Description:
+	Unmaps everything once no request has touched the table for
+	CBTABLE_IDLE_UNMAP_MS, otherwise re-arms itself for the remainder.
+  Arguments:
+	Timer - Handle to the framework timer object.
+  Return Value:
+	None.
+--*/
+{
+	PCBTABLE_CONTEXT pDevice = GetDeviceContext(WdfTimerGetParentObject(Timer));
+	LONG64 timeout = (LONG64)CBTABLE_IDLE_UNMAP_MS * 10000;
+	LONG64 idle = (LONG64)KeQueryInterruptTime() - InterlockedCompareExchange64(&pDevice->lastAccess, 0, 0);
+
+	if (idle < timeout) {
+		WdfTimerStart(Timer, -(timeout - idle));
+		return;
+	}
+
+	//
+	// Don't wait behind a reader; try again on the next period instead.
+	//
+	KeEnterCriticalRegion();
+	if (!ExAcquireResourceExclusiveLite(&pDevice->regionLock, FALSE)) {
+		KeLeaveCriticalRegion();
+		WdfTimerStart(Timer, WDF_REL_TIMEOUT_IN_MS(CBTABLE_IDLE_UNMAP_MS));
+		return;
+	}
+
+	if (pDevice->parsed) {
+		CBTablePrint(DEBUG_LEVEL_INFO, DBG_TABLE, "Unmapping idle coreboot table\n");
+		releaseTable(pDevice);
+	}
+
+	CBTableRelease(pDevice);
+}
@@ -0,0 +1,107 @@
+#include "driver.h"
+#include "tcpa.tmh"
+
+//
+// Replay of the live TCPA measurement log. The log walk is cb_tcpa_replay
+// in cbparse.h, shared with host tools replaying archived logs; the driver
+// only supplies the hashes from kernel CNG. Comparing the result against
+// the TPM's PCRs shows whether the log accounts for every measurement.
+//
+
+static LPCWSTR hashAlgorithms[CBTABLE_PCR_BANKS] = {
+	BCRYPT_SHA1_ALGORITHM,		/* CBTABLE_PCR_SHA1 */
+	BCRYPT_SHA256_ALGORITHM,	/* CBTABLE_PCR_SHA256 */
+};
+
+typedef struct _REPLAY_HASHES {
+	PCBTABLE_CONTEXT pDevice;
+	BCRYPT_HASH_HANDLE hash[CBTABLE_PCR_BANKS];
+	NTSTATUS status;
+} REPLAY_HASHES;
+
+/*
+ * cb_pcr_extend on CNG, with one reusable hash object per bank created
+ * the first time the bank is extended
+ */
+static int extendPcr(void* context, UINT32 bank, UINT8* pcr, const UINT8* digest, UINT32 len) {
+	REPLAY_HASHES* hashes = context;
+	NTSTATUS status = STATUS_SUCCESS;
+
+	if (!hashes->hash[bank]) {
+		if (!hashes->pDevice->hashAlg[bank])
+			status = STATUS_NOT_SUPPORTED;
+		else
+			status = BCryptCreateHash(hashes->pDevice->hashAlg[bank], &hashes->hash[bank], NULL, 0, NULL, 0, BCRYPT_HASH_REUSABLE_FLAG);
+	}
+
+	if (NT_SUCCESS(status))
+		status = BCryptHashData(hashes->hash[bank], pcr, len, 0);
+	if (NT_SUCCESS(status))
+		status = BCryptHashData(hashes->hash[bank], (PUCHAR)digest, len, 0);
+	if (NT_SUCCESS(status))
+		status = BCryptFinishHash(hashes->hash[bank], pcr, len, 0);
+
+	hashes->status = status;
+	return NT_SUCCESS(status) ? 0 : 1;
+}
+
+NTSTATUS CBTableReplayPcrs(PCBTABLE_CONTEXT pDevice, PVOID Buffer, size_t BufLen, size_t *BytesCopied) {
+	struct cbtable_pcr_replay* out = Buffer;
+	REPLAY_HASHES hashes;
+	MemMapping* mapping;
+	NTSTATUS status;
+	int result;
+
+	*BytesCopied = 0;
+
+	if (BufLen < sizeof(*out))
+		return STATUS_BUFFER_TOO_SMALL;
+
+	status = CBTableAcquireRegion(pDevice, NextRequestTcpa, &mapping);
+	if (!NT_SUCCESS(status))
+		return status;
+
+	RtlZeroMemory(&hashes, sizeof(hashes));
+	hashes.pDevice = pDevice;
+
+	struct tcpa_table* tcpa_p = mapping->virtAddr;
+	result = cb_tcpa_replay(tcpa_p, cb_tcpa_count(tcpa_p, mapping->sz), out,
+		(BufLen - sizeof(*out)) / sizeof(out->pcrs[0]), extendPcr, &hashes);
+
+	CBTableRelease(pDevice);
+
+	for (int bank = 0; bank < CBTABLE_PCR_BANKS; bank++) {
+		if (hashes.hash[bank])
+			BCryptDestroyHash(hashes.hash[bank]);
+	}
+
+	*BytesCopied = sizeof(*out);
+
+	if (result == CB_REPLAY_NO_ROOM)
+		return STATUS_BUFFER_OVERFLOW;
+	if (result)
+		return hashes.status;
+
+	*BytesCopied = sizeof(*out) + out->count * sizeof(out->pcrs[0]);
+	return STATUS_SUCCESS;
+}
+
+VOID CBTableOpenHashProviders(PCBTABLE_CONTEXT pDevice) {
+	for (int bank = 0; bank < CBTABLE_PCR_BANKS; bank++) {
+		NTSTATUS status = BCryptOpenAlgorithmProvider(&pDevice->hashAlg[bank], hashAlgorithms[bank], NULL, 0);
+
+		if (!NT_SUCCESS(status)) {
+			CBTablePrint(DEBUG_LEVEL_ERROR, DBG_INIT, "Failed to open %ws provider 0x%x\n", hashAlgorithms[bank], status);
+			pDevice->hashAlg[bank] = NULL;
+		}
+	}
+}
+
+VOID CBTableCloseHashProviders(PCBTABLE_CONTEXT pDevice) {
+	for (int bank = 0; bank < CBTABLE_PCR_BANKS; bank++) {
+		if (pDevice->hashAlg[bank]) {
+			BCryptCloseAlgorithmProvider(pDevice->hashAlg[bank], 0);
+			pDevice->hashAlg[bank] = NULL;
+		}
+	}
+}
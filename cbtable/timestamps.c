@@ -0,0 +1,112 @@
+#include "driver.h"
+
+//
+// Decoding of the CBMEM timestamp table into sorted, microsecond based
+// records, so clients don't have to know the firmware's tick rate.
+//
+
+static BOOLEAN stampBefore(struct cbtable_timestamp* a, struct cbtable_timestamp* b) {
+	if (a->absolute_us != b->absolute_us)
+		return a->absolute_us < b->absolute_us;
+	return a->id < b->id;
+}
+
+static void siftDown(struct cbtable_timestamp* entries, UINT32 root, UINT32 count) {
+	for (;;) {
+		UINT32 child = 2 * root + 1;
+		if (child >= count)
+			return;
+
+		if (child + 1 < count && stampBefore(&entries[child], &entries[child + 1]))
+			child++;
+
+		if (!stampBefore(&entries[root], &entries[child]))
+			return;
+
+		struct cbtable_timestamp tmp = entries[root];
+		entries[root] = entries[child];
+		entries[child] = tmp;
+		root = child;
+	}
+}
+
+/*
+ * heap sort in place, so decoding needs no allocation whatever num_entries
+ * the firmware reports
+ */
+static void sortStamps(struct cbtable_timestamp* entries, UINT32 count) {
+	if (count < 2)
+		return;
+
+	for (UINT32 i = count / 2; i-- > 0;)
+		siftDown(entries, i, count);
+
+	for (UINT32 end = count - 1; end > 0; end--) {
+		struct cbtable_timestamp tmp = entries[0];
+		entries[0] = entries[end];
+		entries[end] = tmp;
+		siftDown(entries, 0, end);
+	}
+}
+
+static INT64 ticksToUs(INT64 ticks, UINT32 freqKhz, UINT32 freqMhz) {
+	if (freqKhz)
+		return (ticks / freqKhz) * 1000 + (ticks % freqKhz) * 1000 / freqKhz;
+	if (freqMhz)
+		return ticks / freqMhz;
+	return ticks;
+}
+
+NTSTATUS CBTableDecodeTimestamps(PCBTABLE_CONTEXT pDevice, PVOID Buffer, size_t BufLen, size_t *BytesCopied) {
+	struct cbtable_timestamps* out = Buffer;
+	MemMapping* mapping;
+	NTSTATUS status;
+
+	*BytesCopied = 0;
+
+	if (BufLen < sizeof(*out))
+		return STATUS_BUFFER_TOO_SMALL;
+
+	status = CBTableAcquireRegion(pDevice, NextRequestTimestamps, &mapping);
+	if (!NT_SUCCESS(status))
+		return status;
+
+	struct timestamp_table* timestamp_p = mapping->virtAddr;
+	UINT32 count = cb_timestamp_count(timestamp_p, mapping->sz);
+
+	out->count = count;
+	out->reserved = 0;
+	*BytesCopied = sizeof(*out);
+
+	if ((BufLen - sizeof(*out)) / sizeof(out->entries[0]) < count) {
+		status = STATUS_BUFFER_OVERFLOW;
+		goto exit;
+	}
+
+	UINT32 freqKhz = 0;
+	struct lb_tsc_info* tsc = CB_ENTRY_VIEW(CBTableGetEntry(pDevice, LB_TAG_TSC_INFO, 0), struct lb_tsc_info);
+	if (tsc)
+		freqKhz = tsc->freq_khz;
+
+	//
+	// Sort on raw ticks first, then convert in place
+	//
+	for (UINT32 i = 0; i < count; i++) {
+		out->entries[i].id = timestamp_p->entries[i].entry_id;
+		out->entries[i].reserved = 0;
+		out->entries[i].absolute_us = (INT64)timestamp_p->base_time + timestamp_p->entries[i].entry_stamp;
+	}
+
+	sortStamps(out->entries, count);
+
+	for (UINT32 i = 0; i < count; i++) {
+		out->entries[i].absolute_us = ticksToUs(out->entries[i].absolute_us, freqKhz, timestamp_p->tick_freq_mhz);
+		out->entries[i].delta_us = i ? (UINT64)(out->entries[i].absolute_us - out->entries[i - 1].absolute_us) : 0;
+	}
+
+	*BytesCopied += count * sizeof(out->entries[0]);
+
+exit:
+	CBTableRelease(pDevice);
+	return status;
+}
@@ -0,0 +1,106 @@
+#if !defined(_CBTABLE_TIMESTAMPS_H_)
+#define _CBTABLE_TIMESTAMPS_H_
+
+//
+// Timestamp ids as defined by coreboot's timestamp_serialized.h, with the
+// names its cbmem utility prints. Expand with a macro taking (id, name):
+//
+//   #define X(id, name) { id, name },
+//   static const struct { UINT32 id; const char* name; } names[] = {
+//       CBTABLE_TIMESTAMP_IDS(X)
+//   };
+//
+
+#define CBTABLE_TIMESTAMP_IDS(X) \
+	X(0, "1st timestamp") \
+	X(1, "start of romstage") \
+	X(2, "before RAM initialization") \
+	X(3, "after RAM initialization") \
+	X(4, "end of romstage") \
+	X(5, "start of verified boot") \
+	X(6, "end of verified boot") \
+	X(8, "starting to load ramstage") \
+	X(9, "finished loading ramstage") \
+	X(10, "start of ramstage") \
+	X(11, "start of bootblock") \
+	X(12, "end of bootblock") \
+	X(13, "starting to load romstage") \
+	X(14, "finished loading romstage") \
+	X(15, "starting LZMA decompress (ignore for x86)") \
+	X(16, "finished LZMA decompress (ignore for x86)") \
+	X(17, "starting LZ4 decompress (ignore for x86)") \
+	X(18, "finished LZ4 decompress (ignore for x86)") \
+	X(30, "device enumeration") \
+	X(40, "device configuration") \
+	X(50, "device enable") \
+	X(60, "device initialization") \
+	X(65, "Option ROM initialization") \
+	X(66, "Option ROM copy done") \
+	X(67, "Option ROM run done") \
+	X(70, "device setup done") \
+	X(75, "cbmem post") \
+	X(80, "write tables") \
+	X(85, "finalize chips") \
+	X(90, "load payload") \
+	X(98, "ACPI wake jump") \
+	X(99, "selfboot jump") \
+	X(100, "start of postcar") \
+	X(101, "end of postcar") \
+	X(110, "forced delay start") \
+	X(111, "forced delay end") \
+	X(112, "started reading uCode") \
+	X(113, "finished reading uCode") \
+	X(114, "started elog init") \
+	X(115, "finished elog init") \
+	X(501, "starting to load verstage") \
+	X(502, "finished loading verstage") \
+	X(503, "starting to initialize TPM") \
+	X(504, "finished TPM initialization") \
+	X(505, "starting to verify keyblock/preamble (RSA)") \
+	X(506, "finished verifying keyblock/preamble (RSA)") \
+	X(507, "starting to verify body (load+SHA2+RSA)") \
+	X(508, "finished loading body") \
+	X(509, "finished calculating body hash (SHA2)") \
+	X(510, "finished verifying body signature (RSA)") \
+	X(511, "starting TPM PCR extend") \
+	X(512, "finished TPM PCR extend") \
+	X(513, "starting locking TPM") \
+	X(514, "finished locking TPM") \
+	X(515, "starting EC software sync") \
+	X(516, "EC vboot hash ready") \
+	X(517, "waiting for EC to allow higher power draw") \
+	X(518, "finished EC software sync") \
+	X(550, "starting to load Chrome OS VPD") \
+	X(551, "finished loading Chrome OS VPD (RO)") \
+	X(552, "finished loading Chrome OS VPD (RW)") \
+	X(553, "started TPM enable update") \
+	X(554, "finished TPM enable update") \
+	X(950, "calling FspMemoryInit") \
+	X(951, "returning from FspMemoryInit") \
+	X(952, "calling FspTempRamExit") \
+	X(953, "returning from FspTempRamExit") \
+	X(954, "calling FspSiliconInit") \
+	X(955, "returning from FspSiliconInit") \
+	X(956, "calling FspNotify(AfterPciEnumeration)") \
+	X(957, "returning from FspNotify(AfterPciEnumeration)") \
+	X(958, "calling FspNotify(ReadyToBoot)") \
+	X(959, "returning from FspNotify(ReadyToBoot)") \
+	X(960, "calling FspNotify(EndOfFirmware)") \
+	X(961, "returning from FspNotify(EndOfFirmware)") \
+	X(962, "calling FspMultiPhaseSiInit") \
+	X(963, "returning from FspMultiPhaseSiInit") \
+	X(1000, "depthcharge start") \
+	X(1001, "RO parameter init") \
+	X(1002, "RO vboot init") \
+	X(1003, "RO vboot select firmware") \
+	X(1004, "RO vboot select&load kernel") \
+	X(1010, "RW vboot select&load kernel") \
+	X(1020, "vboot select&load kernel") \
+	X(1030, "finished EC verification") \
+	X(1040, "finished storage device initialization") \
+	X(1050, "finished reading kernel from disk") \
+	X(1100, "finished vboot kernel verification") \
+	X(1101, "starting kernel") \
+	X(1102, "kernel decompression/relocation done")
+
+#endif
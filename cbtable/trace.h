@@ -3,41 +3,52 @@
 #ifndef _TRACE_H_
 #define _TRACE_H_
 
-extern "C"
-{
-	//
-	// Tracing Definitions:
-	//
-	// Control GUID: 
-	// {73e3b785-f5fb-423e-94a9-56627fea9053}
-	//
+//
+// Tracing Definitions:
+//
+// Control GUID:
+// {a0f01f76-d9b6-48ae-aaaa-b57b7fa6271b}
+//
 
 #define WPP_CONTROL_GUIDS                           \
     WPP_DEFINE_CONTROL_GUID(                        \
-        SpbTestToolTraceGuid,                       \
-        (73e3b785,f5fb,423e,94a9,56627fea9053),     \
-        WPP_DEFINE_BIT(TRACE_FLAG_WDFLOADING)       \
-        WPP_DEFINE_BIT(TRACE_FLAG_SPBAPI)           \
-        WPP_DEFINE_BIT(TRACE_FLAG_OTHER)            \
+        CBTableTraceGuid,                           \
+        (a0f01f76,d9b6,48ae,aaaa,b57b7fa6271b),     \
+        WPP_DEFINE_BIT(DBG_INIT)                    \
+        WPP_DEFINE_BIT(DBG_PNP)                     \
+        WPP_DEFINE_BIT(DBG_IOCTL)                   \
+        WPP_DEFINE_BIT(DBG_TABLE)                   \
         )
-}
 
-#define WPP_LEVEL_FLAGS_LOGGER(level,flags) WPP_LEVEL_LOGGER(flags)
-#define WPP_LEVEL_FLAGS_ENABLED(level, flags) (WPP_LEVEL_ENABLED(flags) && WPP_CONTROL(WPP_BIT_ ## flags).Level >= level)
+#define DEBUG_LEVEL_ERROR   TRACE_LEVEL_ERROR
+#define DEBUG_LEVEL_INFO    TRACE_LEVEL_INFORMATION
+#define DEBUG_LEVEL_VERBOSE TRACE_LEVEL_VERBOSE
 
-#define Trace CyapaPrint
-#define FuncEntry 
-#define FuncExit 
-#define WPP_INIT_TRACING
-#define WPP_CLEANUP 
-#define TRACE_FLAG_SPBAPI 0
-#define TRACE_FLAG_WDFLOADING 0
+//
+// Trace points above this level are compiled out: the level is a
+// constant, so the whole check folds to false and the call is dropped.
+//
+
+#if !defined(CBTABLE_TRACE_MAX_LEVEL)
+#if DBG
+#define CBTABLE_TRACE_MAX_LEVEL TRACE_LEVEL_VERBOSE
+#else
+#define CBTABLE_TRACE_MAX_LEVEL TRACE_LEVEL_INFORMATION
+#endif
+#endif
+
+#define WPP_LEVEL_FLAGS_LOGGER(level, flags) WPP_LEVEL_LOGGER(flags)
+#define WPP_LEVEL_FLAGS_ENABLED(level, flags)       \
+    ((level) <= CBTABLE_TRACE_MAX_LEVEL &&          \
+     WPP_LEVEL_ENABLED(flags) &&                    \
+     WPP_CONTROL(WPP_BIT_ ## flags).Level >= (level))
 
 // begin_wpp config
+// FUNC CBTablePrint(LEVEL, FLAGS, MSG, ...);
 // FUNC FuncEntry{LEVEL=TRACE_LEVEL_VERBOSE}(FLAGS);
 // FUNC FuncExit{LEVEL=TRACE_LEVEL_VERBOSE}(FLAGS);
 // USEPREFIX(FuncEntry, "%!STDPREFIX! [%!FUNC!] --> entry");
 // USEPREFIX(FuncExit, "%!STDPREFIX! [%!FUNC!] <--");
 // end_wpp
 
-#endif _TRACE_H_
+#endif // _TRACE_H_
@@ -0,0 +1,332 @@
+#include "driver.h"
+#include "view.tmh"
+
+//
+// Read-only views of the table regions in a caller's address space, so a
+// monitoring agent can follow the console cursor and the timestamps
+// without a request per sample.
+//
+// A view maps only the pages behind the region, through an MDL built over
+// the driver's own mapping, and only if the memory map puts all of those
+// pages in one table or reserved range. Once built it no longer depends
+// on the driver's mapping, so the idle timer is still free to unmap the
+// table. Views are created in the caller's context from
+// OnIoInCallerContext.
+//
+// A user mapping of locked pages must be gone before its process is torn
+// down, and a handle can outlive its process once duplicated. So views
+// are kept in one list for the driver and unmapped by whichever comes
+// first: the handle being closed, or the process that owns the view
+// exiting. viewLock is held across mapping and unmapping, so the exit
+// notification can't return while another thread is still unmapping a
+// view of the exiting process.
+//
+
+typedef struct _CBTABLE_VIEW {
+	LIST_ENTRY link;
+	WDFFILEOBJECT owner;
+	PEPROCESS process;
+	PMDL mdl;
+	PVOID address;
+	UINT32 region;
+	size_t bytes;
+	UINT64 physical;
+} CBTABLE_VIEW;
+
+static LIST_ENTRY views;
+static FAST_MUTEX viewLock;
+static BOOLEAN exitNotifyRegistered;
+
+/* the view is off the list; a mapped one is only freed under viewLock */
+static VOID freeView(CBTABLE_VIEW* view) {
+	KAPC_STATE apcState;
+
+	if (view->address) {
+		//
+		// The last handle may be closed from another process the handle
+		// was duplicated into; the view lives in its creator.
+		//
+		BOOLEAN attach = PsGetCurrentProcess() != view->process;
+
+		if (attach)
+			KeStackAttachProcess(view->process, &apcState);
+
+		MmUnmapLockedPages(view->address, view->mdl);
+
+		if (attach)
+			KeUnstackDetachProcess(&apcState);
+	}
+
+	if (view->process)
+		ObDereferenceObject(view->process);
+
+	if (view->mdl)
+		IoFreeMdl(view->mdl);
+
+	ExFreePoolWithTag(view, CBTABLE_POOL_TAG);
+}
+
+/* unmaps the views of a handle, or of a process if owner is NULL */
+static VOID freeViews(WDFFILEOBJECT owner, PEPROCESS process) {
+	PLIST_ENTRY entry, next;
+
+	ExAcquireFastMutex(&viewLock);
+
+	for (entry = views.Flink; entry != &views; entry = next) {
+		CBTABLE_VIEW* view = CONTAINING_RECORD(entry, CBTABLE_VIEW, link);
+
+		next = entry->Flink;
+		if (owner ? view->owner != owner : view->process != process)
+			continue;
+
+		RemoveEntryList(&view->link);
+		freeView(view);
+	}
+
+	ExReleaseFastMutex(&viewLock);
+}
+
+static VOID onProcessNotify(PEPROCESS Process, HANDLE ProcessId, PPS_CREATE_NOTIFY_INFO CreateInfo) {
+	UNREFERENCED_PARAMETER(ProcessId);
+
+	if (!CreateInfo)
+		freeViews(NULL, Process);
+}
+
+/*
+ * builds an MDL over the pages of the region, if the memory map shows
+ * they belong to the firmware. Called with the region acquired.
+ */
+static NTSTATUS describeRegion(PCBTABLE_CONTEXT pDevice, enum NextRequest region, MemMapping* mapping, CBTABLE_VIEW* view) {
+	UINT64 first, last;
+	UINT32 type;
+
+	if (mapping->sz > MAXULONG)
+		return STATUS_INSUFFICIENT_RESOURCES;
+
+	view->physical = mapping->physAddr.QuadPart;
+	view->bytes = mapping->sz;
+
+	//
+	// The first and last page are mapped whole, so they must not hold
+	// anything the firmware did not set aside either.
+	//
+	first = view->physical & ~(UINT64)(PAGE_SIZE - 1);
+	last = (view->physical + view->bytes + PAGE_SIZE - 1) & ~(UINT64)(PAGE_SIZE - 1);
+	type = cb_memory_span_type(pDevice->memoryRanges, pDevice->memoryRangeCount, first, last - first);
+
+	if (type != LB_MEM_TABLE && type != LB_MEM_RESERVED) {
+		CBTablePrint(DEBUG_LEVEL_ERROR, DBG_IOCTL, "Region %u at 0x%llx is not in a table or reserved range\n",
+			region, view->physical);
+		return STATUS_ACCESS_DENIED;
+	}
+
+	view->mdl = IoAllocateMdl(mapping->virtAddr, (ULONG)mapping->sz, FALSE, FALSE, NULL);
+	if (!view->mdl)
+		return STATUS_INSUFFICIENT_RESOURCES;
+
+	MmBuildMdlForNonPagedPool(view->mdl);
+	return STATUS_SUCCESS;
+}
+
+/* called with viewLock held */
+static CBTABLE_VIEW* findView(WDFFILEOBJECT owner, PEPROCESS process, UINT32 region, UINT32* processViews) {
+	PLIST_ENTRY entry;
+
+	*processViews = 0;
+
+	for (entry = views.Flink; entry != &views; entry = entry->Flink) {
+		CBTABLE_VIEW* view = CONTAINING_RECORD(entry, CBTABLE_VIEW, link);
+
+		if (view->process != process)
+			continue;
+		if (view->owner == owner && view->region == region)
+			return view;
+		(*processViews)++;
+	}
+
+	return NULL;
+}
+
+static NTSTATUS createView(PCBTABLE_CONTEXT pDevice, WDFFILEOBJECT owner, enum NextRequest region, struct cbtable_region_view* out) {
+	PEPROCESS process = PsGetCurrentProcess();
+	CBTABLE_VIEW* existing;
+	CBTABLE_VIEW* view;
+	MemMapping* mapping;
+	UINT32 processViews;
+	NTSTATUS status;
+
+	view = ExAllocatePoolWithTag(NonPagedPoolNx, sizeof(*view), CBTABLE_POOL_TAG);
+	if (!view)
+		return STATUS_INSUFFICIENT_RESOURCES;
+
+	RtlZeroMemory(view, sizeof(*view));
+	view->owner = owner;
+	view->region = region;
+
+	status = CBTableAcquireRegion(pDevice, region, &mapping);
+	if (NT_SUCCESS(status)) {
+		status = describeRegion(pDevice, region, mapping, view);
+		CBTableRelease(pDevice);
+	}
+
+	if (!NT_SUCCESS(status)) {
+		freeView(view);
+		return status;
+	}
+
+	ExAcquireFastMutex(&viewLock);
+
+	existing = findView(owner, process, region, &processViews);
+	if (existing) {
+		freeView(view);
+		view = existing;
+		goto exit;
+	}
+
+	if (processViews >= CBTABLE_VIEWS_PER_PROCESS) {
+		freeView(view);
+		status = STATUS_QUOTA_EXCEEDED;
+		goto exit;
+	}
+
+	//
+	// Same cache type as the MmMapIoSpace mapping the MDL was built from;
+	// mapping the pages with two cache types is not allowed.
+	//
+	__try {
+		view->address = MmMapLockedPagesSpecifyCache(view->mdl, UserMode, MmCached, NULL, FALSE,
+			NormalPagePriority | MdlMappingNoWrite);
+	}
+	__except (EXCEPTION_EXECUTE_HANDLER) {
+		view->address = NULL;
+	}
+
+	if (!view->address) {
+		CBTablePrint(DEBUG_LEVEL_ERROR, DBG_IOCTL, "Failed to map region %u into the caller\n", region);
+		freeView(view);
+		status = STATUS_INSUFFICIENT_RESOURCES;
+		goto exit;
+	}
+
+	view->process = process;
+	ObReferenceObject(process);
+	InsertTailList(&views, &view->link);
+
+exit:
+	if (NT_SUCCESS(status)) {
+		out->address = (UINT64)(ULONG_PTR)view->address;
+		out->bytes = view->bytes;
+		out->physical = view->physical;
+		out->region = region;
+		out->reserved = 0;
+	}
+
+	ExReleaseFastMutex(&viewLock);
+	return status;
+}
+
+/*
+ * IOCTL_CBTABLE_MAP_REGION, in the context of the requesting thread.
+ * Always completes FxRequest.
+ */
+VOID CBTableMapRegion(PCBTABLE_CONTEXT pDevice, WDFREQUEST FxRequest) {
+	struct cbtable_region_view* out;
+	WDFFILEOBJECT fileObject;
+	PVOID InBuffer;
+	UINT32 region;
+	NTSTATUS status;
+
+	if (!exitNotifyRegistered) {
+		status = STATUS_NOT_SUPPORTED;
+		goto exit;
+	}
+
+	//
+	// The view is limited to firmware memory, but it is still physical
+	// memory mapped into a process. Leave it to callers that may profile
+	// the system anyway.
+	//
+	if (WdfRequestGetRequestorMode(FxRequest) != UserMode) {
+		status = STATUS_INVALID_DEVICE_REQUEST;
+		goto exit;
+	}
+
+	if (!SeSinglePrivilegeCheck(SeExports->SeSystemProfilePrivilege, UserMode)) {
+		status = STATUS_PRIVILEGE_NOT_HELD;
+		goto exit;
+	}
+
+	fileObject = WdfRequestGetFileObject(FxRequest);
+	if (!fileObject) {
+		status = STATUS_INVALID_DEVICE_REQUEST;
+		goto exit;
+	}
+
+	status = WdfRequestRetrieveInputBuffer(FxRequest, sizeof(UINT32), &InBuffer, NULL);
+	if (!NT_SUCCESS(status)) {
+		CBTablePrint(DEBUG_LEVEL_ERROR, DBG_IOCTL, "Failed to get input buffer\n");
+		goto exit;
+	}
+
+	region = ((UINT32*)InBuffer)[0];
+	if (region >= NextRequestReserved) {
+		status = STATUS_INVALID_PARAMETER;
+		goto exit;
+	}
+
+	status = WdfRequestRetrieveOutputBuffer(FxRequest, sizeof(*out), (PVOID*)&out, NULL);
+	if (!NT_SUCCESS(status)) {
+		CBTablePrint(DEBUG_LEVEL_ERROR, DBG_IOCTL, "Failed to get output buffer\n");
+		goto exit;
+	}
+
+	status = createView(pDevice, fileObject, (enum NextRequest)region, out);
+	if (NT_SUCCESS(status))
+		WdfRequestSetInformation(FxRequest, sizeof(*out));
+
+exit:
+	WdfRequestComplete(FxRequest, status);
+}
+
+VOID
+CBTableFileCleanup(
+	_In_  WDFFILEOBJECT  FileObject
+)
+/*++
+  Routine Description:
+	Unmaps the views created on a handle when it is closed.
+  Arguments:
+	FileObject - Handle to the framework file object.
+  Return Value:
+	None.
+--*/
+{
+	freeViews(FileObject, NULL);
+}
+
+/*
+ * Registers for process exit, without which no view is handed out. Never
+ * fails DriverEntry: the rest of the driver works without views.
+ */
+VOID CBTableViewsInit(VOID) {
+	NTSTATUS status;
+
+	InitializeListHead(&views);
+	ExInitializeFastMutex(&viewLock);
+
+	status = PsSetCreateProcessNotifyRoutineEx(onProcessNotify, FALSE);
+	if (!NT_SUCCESS(status)) {
+		CBTablePrint(DEBUG_LEVEL_ERROR, DBG_INIT, "Process notifications unavailable 0x%x, views disabled\n", status);
+		return;
+	}
+
+	exitNotifyRegistered = TRUE;
+}
+
+/* every handle, and so every view, is gone by the time the driver unloads */
+VOID CBTableViewsUnload(VOID) {
+	if (exitNotifyRegistered)
+		PsSetCreateProcessNotifyRoutineEx(onProcessNotify, TRUE);
+	exitNotifyRegistered = FALSE;
+}
@@ -0,0 +1,177 @@
+#include "driver.h"
+
+//
+// Long-poll for console and timestamp changes. Requests whose caller is
+// already behind complete at once, the rest sit in the manual WaitQueue
+// until the wait timer sees the console cursor or the number of timestamps
+// move. The timer is one-shot, armed when a request is queued and re-armed
+// from its callback only while requests remain.
+//
+
+static void armWaitTimer(PCBTABLE_CONTEXT pDevice) {
+	if (InterlockedCompareExchange(&pDevice->waitArmed, 1, 0) == 0)
+		WdfTimerStart(pDevice->waitTimer, WDF_REL_TIMEOUT_IN_MS(CBTABLE_WAIT_POLL_MS));
+}
+
+static NTSTATUS readWaitState(PCBTABLE_CONTEXT pDevice, struct cbtable_wait_state* state) {
+	MemMapping* mapping;
+	NTSTATUS status;
+
+	state->console_cursor = 0;
+	state->timestamp_count = 0;
+
+	status = CBTableAcquireRegion(pDevice, NextRequestConsole, &mapping);
+	if (NT_SUCCESS(status)) {
+		struct cbmem_console* console_p = mapping->virtAddr;
+		state->console_cursor = ReadULongNoFence((volatile ULONG*)&console_p->cursor);
+		CBTableRelease(pDevice);
+	}
+	else if (status != STATUS_DEVICE_NOT_READY) {
+		return status;
+	}
+
+	status = CBTableAcquireRegion(pDevice, NextRequestTimestamps, &mapping);
+	if (NT_SUCCESS(status)) {
+		struct timestamp_table* timestamp_p = mapping->virtAddr;
+		state->timestamp_count = ReadULongNoFence((volatile ULONG*)&timestamp_p->num_entries);
+		CBTableRelease(pDevice);
+	}
+	else if (status != STATUS_DEVICE_NOT_READY) {
+		return status;
+	}
+
+	return STATUS_SUCCESS;
+}
+
+static BOOLEAN stateChanged(struct cbtable_wait_state* seen, struct cbtable_wait_state* current) {
+	return seen->console_cursor != current->console_cursor ||
+		seen->timestamp_count != current->timestamp_count;
+}
+
+static void completeWait(WDFREQUEST FxRequest, struct cbtable_wait_state* current) {
+	struct cbtable_wait_state* out;
+	NTSTATUS status;
+
+	status = WdfRequestRetrieveOutputBuffer(FxRequest, sizeof(*out), (PVOID*)&out, NULL);
+	if (NT_SUCCESS(status)) {
+		*out = *current;
+		WdfRequestSetInformation(FxRequest, sizeof(*out));
+	}
+
+	WdfRequestComplete(FxRequest, status);
+}
+
+/*
+ * completes every pended request whose caller has not seen current yet
+ */
+static void completeWaiters(PCBTABLE_CONTEXT pDevice, struct cbtable_wait_state* current) {
+	WDFREQUEST prevTag = NULL;
+	WDFREQUEST tag;
+	WDFREQUEST FxRequest;
+	NTSTATUS status;
+
+	for (;;) {
+		status = WdfIoQueueFindRequest(pDevice->WaitQueue, prevTag, NULL, NULL, &tag);
+		if (prevTag)
+			WdfObjectDereference(prevTag);
+
+		if (status == STATUS_NOT_FOUND) {
+			/* prevTag left the queue meanwhile, start over */
+			prevTag = NULL;
+			continue;
+		}
+		if (!NT_SUCCESS(status))
+			break;
+
+		if (!stateChanged(&GetWaitContext(tag)->seen, current)) {
+			prevTag = tag;
+			continue;
+		}
+
+		status = WdfIoQueueRetrieveFoundRequest(pDevice->WaitQueue, tag, &FxRequest);
+		WdfObjectDereference(tag);
+		prevTag = NULL;
+
+		if (NT_SUCCESS(status))
+			completeWait(FxRequest, current);
+		else if (status != STATUS_NOT_FOUND)
+			break;
+	}
+}
+
+/*
+ * returns STATUS_PENDING once FxRequest has been completed or queued, any
+ * other status leaves it to the caller to complete
+ */
+NTSTATUS CBTableWaitForChange(PCBTABLE_CONTEXT pDevice, WDFREQUEST FxRequest, struct cbtable_wait_state* seen) {
+	struct cbtable_wait_state current;
+	PCBTABLE_WAIT_CONTEXT waitContext;
+	WDF_OBJECT_ATTRIBUTES attributes;
+	NTSTATUS status;
+
+	status = readWaitState(pDevice, &current);
+	if (!NT_SUCCESS(status))
+		return status;
+
+	if (stateChanged(seen, &current)) {
+		completeWait(FxRequest, &current);
+		return STATUS_PENDING;
+	}
+
+	WDF_OBJECT_ATTRIBUTES_INIT_CONTEXT_TYPE(&attributes, CBTABLE_WAIT_CONTEXT);
+	status = WdfObjectAllocateContext(FxRequest, &attributes, (PVOID*)&waitContext);
+	if (!NT_SUCCESS(status))
+		return status;
+
+	waitContext->seen = *seen;
+
+	//
+	// A change between the read above and the forward is picked up by
+	// the next timer tick, which compares against seen again.
+	//
+	status = WdfRequestForwardToIoQueue(FxRequest, pDevice->WaitQueue);
+	if (!NT_SUCCESS(status))
+		return status;
+
+	armWaitTimer(pDevice);
+	return STATUS_PENDING;
+}
+
+VOID
+CBTableWaitTimer(
+	_In_  WDFTIMER  Timer
+)
+/*++
+  Routine Description:
+	Checks the console cursor and timestamp count on behalf of the
+	requests pended in WaitQueue, and re-arms itself while any remain.
+	Once the queue drains the timer stays idle until the next request
+	is queued.
+  Arguments:
+	Timer - Handle to the framework timer object.
+  Return Value:
+	None.
+--*/
+{
+	PCBTABLE_CONTEXT pDevice = GetDeviceContext(WdfTimerGetParentObject(Timer));
+	struct cbtable_wait_state current;
+	ULONG pending = 0;
+
+	//
+	// Disarm before looking at the queue, so a request forwarded from
+	// here on either is seen below or arms the timer itself.
+	//
+	InterlockedExchange(&pDevice->waitArmed, 0);
+
+	WdfIoQueueGetState(pDevice->WaitQueue, &pending, NULL);
+	if (!pending)
+		return;
+
+	if (NT_SUCCESS(readWaitState(pDevice, &current)))
+		completeWaiters(pDevice, &current);
+
+	pending = 0;
+	WdfIoQueueGetState(pDevice->WaitQueue, &pending, NULL);
+	if (pending)
+		armWaitTimer(pDevice);
+}
@@ -0,0 +1,298 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "cbimage.h"
+
+/*
+ * Parse, checksum and region read timings over synthetic images. Every
+ * case runs a number of times and reports the latency percentiles of a
+ * single run, plus the throughput at the median where bytes are moved.
+ */
+
+static volatile UINT64 sink;
+static int quick;
+
+static double nowNs(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static int compareDouble(const void* a, const void* b)
+{
+	double x = *(const double*)a, y = *(const double*)b;
+
+	return x < y ? -1 : x > y;
+}
+
+/* runs for a case moving bytes each time, enough to be stable but bounded */
+static size_t runsFor(UINT64 bytes)
+{
+	UINT64 budget = quick ? (8 << 20) : (512 << 20);
+	size_t lo = quick ? 3 : 16, hi = quick ? 50 : 2000;
+	UINT64 runs = bytes ? budget / bytes : hi;
+
+	return runs < lo ? lo : runs > hi ? hi : (size_t)runs;
+}
+
+static void formatSize(UINT64 bytes, char* out, size_t room)
+{
+	if (bytes >= (1 << 20) && !(bytes % (1 << 20)))
+		snprintf(out, room, "%lluM", (unsigned long long)(bytes >> 20));
+	else if (bytes >= 1024 && !(bytes % 1024))
+		snprintf(out, room, "%lluK", (unsigned long long)(bytes >> 10));
+	else
+		snprintf(out, room, "%llu", (unsigned long long)bytes);
+}
+
+static void printHeader(void)
+{
+	printf("%-30s %8s %6s %10s %10s %10s %10s %9s\n",
+		"case", "size", "runs", "p50 us", "p90 us", "p99 us", "max us", "GB/s p50");
+}
+
+/* sorts ns in place and prints one result line */
+static void report(const char* name, UINT64 size, UINT64 bytes, double* ns, size_t runs)
+{
+	char sizeText[24];
+	double p50, p90, p99;
+
+	qsort(ns, runs, sizeof(ns[0]), compareDouble);
+	p50 = ns[(runs - 1) * 50 / 100];
+	p90 = ns[(runs - 1) * 90 / 100];
+	p99 = ns[(runs - 1) * 99 / 100];
+
+	formatSize(size, sizeText, sizeof(sizeText));
+	printf("%-30s %8s %6zu %10.2f %10.2f %10.2f %10.2f", name, sizeText, runs,
+		p50 / 1e3, p90 / 1e3, p99 / 1e3, ns[runs - 1] / 1e3);
+	if (bytes)
+		printf(" %9.2f", bytes / p50);
+	printf("\n");
+}
+
+/*
+ * finding the table from the low forward, checking it and walking every
+ * entry, as the driver does on its first request
+ */
+static int benchParse(void)
+{
+	static const UINT32 counts[] = { 16, 256, 4096, 32768 };
+	size_t c, i;
+
+	for (c = 0; c < sizeof(counts) / sizeof(counts[0]) - (quick ? 2 : 0); c++) {
+		struct cbimage_config config;
+		struct cbimage image;
+		size_t runs = quick ? 50 : 2000;
+		double* ns = malloc(runs * sizeof(*ns));
+
+		cbimage_defaults(&config);
+		config.entries = counts[c];
+		config.console_size = 4096;
+		if (!ns || cbimage_build(&config, &image)) {
+			free(ns);
+			return -1;
+		}
+
+		for (i = 0; i < runs; i++) {
+			double start = nowNs();
+			struct coreboot_table_header* low = cb_table_valid(image.data + CBIMAGE_LOW_TABLE, image.size - CBIMAGE_LOW_TABLE);
+			struct lb_forward* forward = low ? CB_ENTRY_VIEW(cb_find_entry(low, LB_TAG_FORWARD), struct lb_forward) : NULL;
+			struct coreboot_table_header* hdr = NULL;
+			struct coreboot_table_entry* entry;
+			struct cb_entry_iter it;
+			UINT64 sum = 0;
+
+			if (forward && forward->forward < image.size)
+				hdr = cb_table_valid(image.data + forward->forward, image.size - (size_t)forward->forward);
+			if (hdr) {
+				cb_for_each_entry(entry, it, hdr)
+					sum += entry->tag;
+			}
+
+			sink += sum;
+			ns[i] = nowNs() - start;
+		}
+
+		{
+			char name[32];
+
+			snprintf(name, sizeof(name), "parse %u entries", counts[c]);
+			report(name, ((struct coreboot_table_header*)(image.data + image.table))->table_bytes, 0, ns, runs);
+		}
+
+		cbimage_free(&image);
+		free(ns);
+	}
+
+	return 0;
+}
+
+static int benchChecksum(void)
+{
+	static const size_t sizes[] = { 4 << 10, 64 << 10, 1 << 20, 16 << 20 };
+	size_t s, i;
+
+	for (s = 0; s < sizeof(sizes) / sizeof(sizes[0]) - (quick ? 2 : 0); s++) {
+		size_t runs = runsFor(sizes[s]);
+		UINT8* buf = malloc(sizes[s]);
+		double* ns = malloc(runs * sizeof(*ns));
+		UINT32 state = 1;
+
+		if (!buf || !ns) {
+			free(buf);
+			free(ns);
+			return -1;
+		}
+
+		for (i = 0; i < sizes[s]; i++) {
+			state = state * 1103515245u + 12345u;
+			buf[i] = (UINT8)(state >> 16);
+		}
+
+		for (i = 0; i < runs; i++) {
+			double start = nowNs();
+			sink += cb_sum_words(buf, sizes[s]);
+			ns[i] = nowNs() - start;
+		}
+		report("checksum scalar", sizes[s], sizes[s], ns, runs);
+
+#if defined(CB_HAVE_SSE2)
+		for (i = 0; i < runs; i++) {
+			double start = nowNs();
+			sink += cb_sum_words_sse2(buf, sizes[s]);
+			ns[i] = nowNs() - start;
+		}
+		report("checksum sse2", sizes[s], sizes[s], ns, runs);
+#endif
+
+		free(buf);
+		free(ns);
+	}
+
+	return 0;
+}
+
+/* one whole-region read, or 64 KiB chunked reads until the region ends */
+static void readRegion(UINT32 region, UINT8* image, size_t size, UINT8* out, size_t outLen, int chunked)
+{
+	UINT64 offset = 0;
+	size_t got;
+
+	if (!chunked) {
+		sink += cb_region_read(region, image, size, 0, out, outLen);
+		return;
+	}
+
+	do {
+		got = cb_region_read(region, image, size, offset, out, 64 << 10);
+		offset += got;
+	} while (got == 64 << 10);
+
+	sink += offset;
+}
+
+static int benchRead(const char* name, UINT32 region, UINT8* image, size_t size, int chunked)
+{
+	size_t bytes = cb_region_length(region, image, size);
+	size_t runs = runsFor(bytes), i;
+	UINT8* out = malloc(bytes ? bytes : 1);
+	double* ns = malloc(runs * sizeof(*ns));
+
+	if (!out || !ns) {
+		free(out);
+		free(ns);
+		return -1;
+	}
+
+	for (i = 0; i < runs; i++) {
+		double start = nowNs();
+		readRegion(region, image, size, out, bytes, chunked);
+		ns[i] = nowNs() - start;
+	}
+	report(name, bytes, bytes, ns, runs);
+
+	free(out);
+	free(ns);
+	return 0;
+}
+
+static int benchRegions(void)
+{
+	static const UINT32 consoleSizes[] = { 64 << 10, 1 << 20, 16 << 20, 64 << 20 };
+	struct cbimage_config config;
+	struct cbimage image;
+	size_t c;
+	int wrapped;
+
+	for (c = 0; c < sizeof(consoleSizes) / sizeof(consoleSizes[0]) - (quick ? 2 : 0); c++) {
+		for (wrapped = 0; wrapped < 2; wrapped++) {
+			UINT8* console;
+			size_t size;
+
+			cbimage_defaults(&config);
+			config.console_size = consoleSizes[c];
+			config.console_wrapped = wrapped;
+			config.timestamps = 0;
+			config.tcpa = 0;
+			if (cbimage_build(&config, &image))
+				return -1;
+
+			console = image.data + image.console;
+			size = sizeof(struct cbmem_console) + config.console_size;
+
+			if (benchRead(wrapped ? "console wrapped" : "console", NextRequestConsole, console, size, 0) ||
+				benchRead(wrapped ? "console wrapped, 64K chunks" : "console, 64K chunks", NextRequestConsole, console, size, 1)) {
+				cbimage_free(&image);
+				return -1;
+			}
+
+			cbimage_free(&image);
+		}
+	}
+
+	cbimage_defaults(&config);
+	config.console_size = 4096;
+	config.timestamps = quick ? 1024 : 65535;
+	config.tcpa = quick ? 64 : 4096;
+	if (cbimage_build(&config, &image))
+		return -1;
+
+	if (benchRead("timestamps", NextRequestTimestamps, image.data + image.timestamps, image.size - (size_t)image.timestamps, 0) ||
+		benchRead("tcpa", NextRequestTcpa, image.data + image.tcpa, image.size - (size_t)image.tcpa, 0)) {
+		cbimage_free(&image);
+		return -1;
+	}
+
+	cbimage_free(&image);
+	return 0;
+}
+
+int main(int argc, char** argv)
+{
+	int opt;
+
+	while ((opt = getopt(argc, argv, "q")) != -1) {
+		switch (opt) {
+		case 'q':
+			quick = 1;
+			break;
+		default:
+			fprintf(stderr, "usage: cbbench [-q]\n");
+			return 2;
+		}
+	}
+
+	printHeader();
+
+	if (benchParse() || benchChecksum() || benchRegions()) {
+		fprintf(stderr, "cbbench: out of memory\n");
+		return 1;
+	}
+
+	return 0;
+}
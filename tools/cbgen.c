@@ -0,0 +1,88 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "cbimage.h"
+
+/*
+ * Writes a synthetic coreboot memory image, see cbimage.h. cbread -i and
+ * cbbench take the same images.
+ */
+
+static void usage(void)
+{
+	fprintf(stderr,
+		"usage: cbgen [options] image\n"
+		"  -n entries   table entries (default 32)\n"
+		"  -c size      console ring size, K/M suffix (default 128K)\n"
+		"  -w           wrap the console\n"
+		"  -l           keep the table low, without a forward\n"
+		"  -m           no line level markers in the console\n"
+		"  -t count     timestamp max_entries (default 128)\n"
+		"  -p count     TCPA log max_entries (default 32)\n"
+		"  -s seed      seed for the generated contents (default 1)\n");
+	exit(2);
+}
+
+int main(int argc, char** argv)
+{
+	struct cbimage_config config;
+	struct cbimage image;
+	FILE* out;
+	int opt;
+
+	cbimage_defaults(&config);
+
+	while ((opt = getopt(argc, argv, "n:c:wlmt:p:s:")) != -1) {
+		switch (opt) {
+		case 'n':
+			config.entries = (UINT32)strtoul(optarg, NULL, 0);
+			break;
+		case 'c':
+			config.console_size = (UINT32)cbimage_parse_size(optarg);
+			break;
+		case 'w':
+			config.console_wrapped = 1;
+			break;
+		case 'l':
+			config.forward = 0;
+			break;
+		case 'm':
+			config.markers = 0;
+			break;
+		case 't':
+			config.timestamps = (UINT16)strtoul(optarg, NULL, 0);
+			break;
+		case 'p':
+			config.tcpa = (UINT16)strtoul(optarg, NULL, 0);
+			break;
+		case 's':
+			config.seed = (UINT32)strtoul(optarg, NULL, 0);
+			break;
+		default:
+			usage();
+		}
+	}
+
+	if (optind != argc - 1)
+		usage();
+
+	if (cbimage_build(&config, &image)) {
+		fprintf(stderr, "cbgen: cannot build an image with these settings\n");
+		return 1;
+	}
+
+	out = fopen(argv[optind], "wb");
+	if (!out || fwrite(image.data, 1, image.size, out) != image.size || fclose(out)) {
+		perror(argv[optind]);
+		cbimage_free(&image);
+		return 1;
+	}
+
+	printf("table 0x%llx console 0x%llx timestamps 0x%llx tcpa 0x%llx, %zu bytes\n",
+		(unsigned long long)image.table, (unsigned long long)image.console,
+		(unsigned long long)image.timestamps, (unsigned long long)image.tcpa, image.size);
+
+	cbimage_free(&image);
+	return 0;
+}
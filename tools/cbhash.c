@@ -0,0 +1,192 @@
+#include <string.h>
+
+#include "cbhash.h"
+
+/* FIPS 180-4, written for clarity over speed */
+
+#define ROL(x, n) (((x) << (n)) | ((x) >> (32 - (n))))
+#define ROR(x, n) (((x) >> (n)) | ((x) << (32 - (n))))
+
+typedef void (*BlockFunction)(UINT32* state, const UINT8* block);
+
+static UINT32 loadBig(const UINT8* p)
+{
+	return ((UINT32)p[0] << 24) | ((UINT32)p[1] << 16) | ((UINT32)p[2] << 8) | p[3];
+}
+
+static void storeBig(UINT8* p, UINT32 v)
+{
+	p[0] = (UINT8)(v >> 24);
+	p[1] = (UINT8)(v >> 16);
+	p[2] = (UINT8)(v >> 8);
+	p[3] = (UINT8)v;
+}
+
+static void sha1Block(UINT32* state, const UINT8* block)
+{
+	UINT32 w[80];
+	UINT32 a = state[0], b = state[1], c = state[2], d = state[3], e = state[4];
+	int i;
+
+	for (i = 0; i < 16; i++)
+		w[i] = loadBig(block + i * 4);
+	for (; i < 80; i++)
+		w[i] = ROL(w[i - 3] ^ w[i - 8] ^ w[i - 14] ^ w[i - 16], 1);
+
+	for (i = 0; i < 80; i++) {
+		UINT32 f, k, t;
+
+		if (i < 20) {
+			f = (b & c) | (~b & d);
+			k = 0x5a827999;
+		}
+		else if (i < 40) {
+			f = b ^ c ^ d;
+			k = 0x6ed9eba1;
+		}
+		else if (i < 60) {
+			f = (b & c) | (b & d) | (c & d);
+			k = 0x8f1bbcdc;
+		}
+		else {
+			f = b ^ c ^ d;
+			k = 0xca62c1d6;
+		}
+
+		t = ROL(a, 5) + f + e + k + w[i];
+		e = d;
+		d = c;
+		c = ROL(b, 30);
+		b = a;
+		a = t;
+	}
+
+	state[0] += a;
+	state[1] += b;
+	state[2] += c;
+	state[3] += d;
+	state[4] += e;
+}
+
+static const UINT32 sha256K[64] = {
+	0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+	0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+	0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+	0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+	0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+	0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+	0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+	0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2,
+};
+
+static void sha256Block(UINT32* state, const UINT8* block)
+{
+	UINT32 w[64];
+	UINT32 a = state[0], b = state[1], c = state[2], d = state[3];
+	UINT32 e = state[4], f = state[5], g = state[6], h = state[7];
+	int i;
+
+	for (i = 0; i < 16; i++)
+		w[i] = loadBig(block + i * 4);
+	for (; i < 64; i++) {
+		UINT32 s0 = ROR(w[i - 15], 7) ^ ROR(w[i - 15], 18) ^ (w[i - 15] >> 3);
+		UINT32 s1 = ROR(w[i - 2], 17) ^ ROR(w[i - 2], 19) ^ (w[i - 2] >> 10);
+
+		w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+	}
+
+	for (i = 0; i < 64; i++) {
+		UINT32 t1 = h + (ROR(e, 6) ^ ROR(e, 11) ^ ROR(e, 25)) + ((e & f) ^ (~e & g)) + sha256K[i] + w[i];
+		UINT32 t2 = (ROR(a, 2) ^ ROR(a, 13) ^ ROR(a, 22)) + ((a & b) ^ (a & c) ^ (b & c));
+
+		h = g;
+		g = f;
+		f = e;
+		e = d + t1;
+		d = c;
+		c = b;
+		b = a;
+		a = t1 + t2;
+	}
+
+	state[0] += a;
+	state[1] += b;
+	state[2] += c;
+	state[3] += d;
+	state[4] += e;
+	state[5] += f;
+	state[6] += g;
+	state[7] += h;
+}
+
+/*
+ * runs block over data and the padding both hashes share: a 1 bit, zeros,
+ * and the message length in bits as a big-endian 64 bit value
+ */
+static void hashPadded(BlockFunction block, UINT32* state, const void* data, size_t size)
+{
+	const UINT8* p = data;
+	UINT64 bits = (UINT64)size * 8;
+	UINT8 tail[128];
+	size_t rest = size % 64;
+	size_t tailLen = rest < 56 ? 64 : 128;
+	size_t i;
+
+	for (i = 0; i + 64 <= size; i += 64)
+		block(state, p + i);
+
+	memset(tail, 0, sizeof(tail));
+	memcpy(tail, p + i, rest);
+	tail[rest] = 0x80;
+	storeBig(tail + tailLen - 8, (UINT32)(bits >> 32));
+	storeBig(tail + tailLen - 4, (UINT32)bits);
+
+	for (i = 0; i < tailLen; i += 64)
+		block(state, tail + i);
+}
+
+void cbhash_sha1(const void* data, size_t size, UINT8 out[CBHASH_SHA1_LENGTH])
+{
+	UINT32 state[5] = { 0x67452301, 0xefcdab89, 0x98badcfe, 0x10325476, 0xc3d2e1f0 };
+	int i;
+
+	hashPadded(sha1Block, state, data, size);
+	for (i = 0; i < 5; i++)
+		storeBig(out + i * 4, state[i]);
+}
+
+void cbhash_sha256(const void* data, size_t size, UINT8 out[CBHASH_SHA256_LENGTH])
+{
+	UINT32 state[8] = {
+		0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19,
+	};
+	int i;
+
+	hashPadded(sha256Block, state, data, size);
+	for (i = 0; i < 8; i++)
+		storeBig(out + i * 4, state[i]);
+}
+
+int cbhash_extend(void* context, UINT32 bank, UINT8* pcr, const UINT8* digest, UINT32 len)
+{
+	UINT8 buf[2 * CBTABLE_PCR_DIGEST_MAX];
+
+	(void)context;
+
+	if (len != cb_pcr_digest_length(bank))
+		return 1;
+
+	memcpy(buf, pcr, len);
+	memcpy(buf + len, digest, len);
+
+	switch (bank) {
+	case CBTABLE_PCR_SHA1:
+		cbhash_sha1(buf, 2 * len, pcr);
+		return 0;
+	case CBTABLE_PCR_SHA256:
+		cbhash_sha256(buf, 2 * len, pcr);
+		return 0;
+	default:
+		return 1;
+	}
+}
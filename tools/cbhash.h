@@ -0,0 +1,24 @@
+#ifndef __CBHASH_H__
+#define __CBHASH_H__
+
+/*
+ * SHA-1 and SHA-256 for replaying TCPA logs on the host, so the tools
+ * need no crypto library. Only whole buffers are hashed; PCR extends
+ * never hash more than two digests at a time.
+ */
+
+#include "cbparse.h"
+
+#define CBHASH_SHA1_LENGTH	20
+#define CBHASH_SHA256_LENGTH	32
+
+void cbhash_sha1(const void* data, size_t size, UINT8 out[CBHASH_SHA1_LENGTH]);
+void cbhash_sha256(const void* data, size_t size, UINT8 out[CBHASH_SHA256_LENGTH]);
+
+/*
+ * cb_pcr_extend with the real hash of each bank, pcr = H(pcr || digest).
+ * context is unused. Returns 1 for an unknown bank or digest length.
+ */
+int cbhash_extend(void* context, UINT32 bank, UINT8* pcr, const UINT8* digest, UINT32 len);
+
+#endif /* __CBHASH_H__ */
@@ -0,0 +1,469 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "cbimage.h"
+
+#define ALIGN_UP(x, a) (((x) + (a) - 1) & ~(UINT64)((a) - 1))
+
+static const char* stages[] = {
+	"bootblock", "verstage", "romstage", "postcar", "ramstage",
+};
+
+#define STAGE_COUNT (sizeof(stages) / sizeof(stages[0]))
+
+static const UINT32 timestampIds[] = {
+	0, 1, 2, 3, 4, 5, 6, 8, 9, 10, 11, 12, 13, 14, 15, 30, 40, 50, 60, 70,
+	75, 80, 90, 98, 99, 100, 1000, 1001, 1002, 1003, 1100, 1101,
+};
+
+/* CMOS options, deliberately not in name order, and their defaults */
+static const struct {
+	const char* name;
+	UINT32 bit;
+	UINT32 length;
+	UINT32 config;
+	UINT32 config_id;
+	UINT32 value;
+} cmosOptions[] = {
+	{ "reboot_counter", 388, 4, 'h', 0, 3 },
+	{ "boot_option", 384, 1, 'e', 1, 1 },
+	{ "sata_mode", 398, 3, 'e', 3, 5 },
+	{ "debug_level", 392, 4, 'e', 2, 7 },
+	{ "boot_delay", 405, 14, 'h', 0, 0x2a5b },
+	{ "power_on_after_fail", 401, 1, 'e', 4, 1 },
+	{ "check_sum", 984, 16, 'h', 0, 0xbeef },
+};
+
+#define CMOS_OPTION_COUNT (sizeof(cmosOptions) / sizeof(cmosOptions[0]))
+
+static const struct {
+	UINT32 config_id;
+	UINT32 value;
+	const char* text;
+} cmosEnums[] = {
+	{ 1, 0, "Fallback" },
+	{ 1, 1, "Normal" },
+	{ 2, 6, "Info" },
+	{ 2, 7, "Debug" },
+	{ 2, 8, "Spew" },
+	{ 3, 0, "AHCI" },
+	{ 3, 1, "Compatible" },
+	{ 3, 5, "RAID" },
+	{ 4, 0, "Disable" },
+	{ 4, 1, "Enable" },
+};
+
+#define CMOS_ENUM_COUNT (sizeof(cmosEnums) / sizeof(cmosEnums[0]))
+
+static UINT32 nextRandom(UINT32* state)
+{
+	*state = *state * 1103515245u + 12345u;
+	return *state >> 8;
+}
+
+void cbimage_defaults(struct cbimage_config* config)
+{
+	memset(config, 0, sizeof(*config));
+	config->entries = 32;
+	config->forward = 1;
+	config->console_size = 128 * 1024;
+	config->markers = 1;
+	config->options = 1;
+	config->timestamps = 128;
+	config->tcpa = 32;
+	config->seed = 1;
+}
+
+/*
+ * one console line, NUL terminated in line; returns its length including
+ * the newline
+ */
+static size_t makeLine(const struct cbimage_config* config, UINT32* state, UINT32 stage, int banner, char* line, size_t room)
+{
+	char* p = line;
+	int n;
+
+	if (config->markers)
+		*p++ = banner ? CBIMAGE_MARKER_NOTICE : CBIMAGE_MARKER_DEBUG;
+
+	if (banner && stage < STAGE_COUNT) {
+		n = snprintf(p, room - 1, "coreboot-4.22 Fri Jan 12 10:00:00 UTC 2024 %s starting (log level: 7)...\n",
+			stages[stage]);
+	}
+	else if (banner) {
+		n = snprintf(p, room - 1, "Jumping to boot code at 0x%08x(0x%08x)\n",
+			0x800000 + (nextRandom(state) & 0xff000), 0x7ffff000);
+	}
+	else {
+		UINT32 r = nextRandom(state);
+
+		switch (r % 4) {
+		case 0:
+			n = snprintf(p, room - 1, "PCI: 00:%02x.%u [8086/%04x] enabled\n",
+				(r >> 4) & 0x1f, (r >> 9) & 7, (r >> 12) & 0xffff);
+			break;
+		case 1:
+			n = snprintf(p, room - 1, "CBFS: Found 'fallback/%s' @0x%x size 0x%x\n",
+				stages[(r >> 4) % STAGE_COUNT], (r >> 8) & 0xfffff, (r >> 2) & 0xffff);
+			break;
+		case 2:
+			n = snprintf(p, room - 1, "BS: BS_DEV_ENUMERATE run times (exec / console): %u / %u ms\n",
+				(r >> 4) & 0xff, (r >> 12) & 0xff);
+			break;
+		default:
+			n = snprintf(p, room - 1, "MTRR: Fixed MSR 0x%x 0x%08x%08x\n",
+				0x250 + ((r >> 4) & 0xf), r, ~r);
+			break;
+		}
+	}
+
+	return (size_t)(p - line) + (size_t)n;
+}
+
+/*
+ * the whole console stream as coreboot wrote it: the stage banners spread
+ * evenly over total bytes, debug lines in between, and the payload hand-off
+ * at the end
+ */
+static UINT8* makeConsoleStream(const struct cbimage_config* config, size_t total, size_t* length)
+{
+	UINT32 state = config->seed ^ 0x434f4e53;
+	UINT8* text = malloc(total + 256);
+	size_t used = 0;
+	UINT32 stage = 0;
+	char line[256];
+
+	if (!text)
+		return NULL;
+
+	while (used < total) {
+		size_t len;
+
+		if (stage < STAGE_COUNT && used >= stage * total / (STAGE_COUNT + 1))
+			len = makeLine(config, &state, stage++, 1, line, sizeof(line));
+		else if (stage == STAGE_COUNT && used >= total * STAGE_COUNT / (STAGE_COUNT + 1) && total - used < 128)
+			len = makeLine(config, &state, stage++, 1, line, sizeof(line));
+		else
+			len = makeLine(config, &state, stage, 0, line, sizeof(line));
+
+		memcpy(text + used, line, len);
+		used += len;
+	}
+
+	*length = used;
+	return text;
+}
+
+static int buildConsole(const struct cbimage_config* config, struct cbimage* image, UINT8* at)
+{
+	struct cbmem_console* console_p = (struct cbmem_console*)at;
+	UINT8* ring = (UINT8*)(console_p + 1);
+	size_t target, total, i;
+	UINT8* stream;
+
+	target = config->console_wrapped ? config->console_size + config->console_size / 2 : config->console_size / 2;
+	stream = makeConsoleStream(config, target, &total);
+	if (!stream)
+		return -1;
+
+	if (!config->console_wrapped && total > config->console_size)
+		total = config->console_size;
+
+	for (i = 0; i < total; i++)
+		ring[i % config->console_size] = stream[i];
+
+	console_p->size = config->console_size;
+	if (total > config->console_size)
+		console_p->cursor = (UINT32)(total % config->console_size) | CBMC_OVERFLOW;
+	else
+		console_p->cursor = (UINT32)total;
+
+	image->console_length = (UINT32)(total < config->console_size ? total : config->console_size);
+	image->console_text = malloc(image->console_length ? image->console_length : 1);
+	if (!image->console_text) {
+		free(stream);
+		return -1;
+	}
+
+	memcpy(image->console_text, stream + total - image->console_length, image->console_length);
+	free(stream);
+	return 0;
+}
+
+static void buildTimestamps(const struct cbimage_config* config, UINT8* at)
+{
+	struct timestamp_table* timestamp_p = (struct timestamp_table*)at;
+	UINT32 state = config->seed ^ 0x54494d45;
+	INT64 stamp = 0;
+	UINT32 i;
+
+	timestamp_p->base_time = 0;
+	timestamp_p->max_entries = config->timestamps;
+	timestamp_p->tick_freq_mhz = 2400;
+	timestamp_p->num_entries = config->timestamps;
+
+	for (i = 0; i < config->timestamps; i++) {
+		struct timestamp_entry entry;
+
+		stamp += 1000 + nextRandom(&state) % 5000000;
+		entry.entry_id = timestampIds[i % (sizeof(timestampIds) / sizeof(timestampIds[0]))];
+		entry.entry_stamp = stamp;
+		memcpy((UINT8*)timestamp_p->entries + i * sizeof(entry), &entry, sizeof(entry));
+	}
+}
+
+static void buildTcpa(const struct cbimage_config* config, UINT8* at)
+{
+	struct tcpa_table* tcpa_p = (struct tcpa_table*)at;
+	UINT32 state = config->seed ^ 0x54435041;
+	UINT32 i, j;
+
+	tcpa_p->max_entries = config->tcpa;
+	tcpa_p->num_entries = config->tcpa;
+
+	for (i = 0; i < config->tcpa; i++) {
+		struct tcpa_entry entry;
+		int sha256 = i & 1;
+
+		memset(&entry, 0, sizeof(entry));
+		entry.pcr = (i / 2) % 8;
+		snprintf(entry.digest_type, sizeof(entry.digest_type), "%s", sha256 ? "SHA256" : "SHA1");
+		entry.digest_length = sha256 ? 32 : 20;
+		for (j = 0; j < entry.digest_length; j++)
+			entry.digest[j] = (UINT8)nextRandom(&state);
+		snprintf(entry.name, sizeof(entry.name), "CBFS: fallback/%s", stages[i % STAGE_COUNT]);
+		memcpy((UINT8*)tcpa_p->entries + i * sizeof(entry), &entry, sizeof(entry));
+	}
+}
+
+static UINT8* addEntry(UINT8** p, UINT32 tag, UINT32 size)
+{
+	struct coreboot_table_entry* entry = (struct coreboot_table_entry*)*p;
+
+	entry->tag = tag;
+	entry->size = size;
+	*p += size;
+	return (UINT8*)entry;
+}
+
+static void addRef(UINT8** p, UINT32 tag, UINT64 addr)
+{
+	struct lb_cbmem_ref* ref = (struct lb_cbmem_ref*)addEntry(p, tag, sizeof(struct lb_cbmem_ref));
+
+	ref->cbmem_addr = addr;
+}
+
+static void setRange(struct lb_memory_range* range, UINT64 start, UINT64 size, UINT32 type)
+{
+	range->start.lo = (UINT32)start;
+	range->start.hi = (UINT32)(start >> 32);
+	range->size.lo = (UINT32)size;
+	range->size.hi = (UINT32)(size >> 32);
+	range->type = type;
+}
+
+static UINT32 optionTableBytes(void)
+{
+	return (UINT32)(sizeof(struct cmos_option_table) + CMOS_OPTION_COUNT * sizeof(struct cmos_entries) +
+		CMOS_ENUM_COUNT * sizeof(struct cmos_enums) + sizeof(struct cmos_defaults));
+}
+
+/* the option table with its options, enums and a defaults image holding each option's value */
+static void addOptions(UINT8** p)
+{
+	struct cmos_option_table* table = (struct cmos_option_table*)addEntry(p, LB_TAG_CMOS_OPTION_TABLE, optionTableBytes());
+	UINT8* record = (UINT8*)(table + 1);
+	struct cmos_defaults* defaults;
+	UINT32 i, j;
+
+	table->header_length = sizeof(*table);
+
+	for (i = 0; i < CMOS_OPTION_COUNT; i++) {
+		struct cmos_entries* option = (struct cmos_entries*)addEntry(&record, LB_TAG_OPTION, sizeof(struct cmos_entries));
+
+		option->bit = cmosOptions[i].bit;
+		option->length = cmosOptions[i].length;
+		option->config = cmosOptions[i].config;
+		option->config_id = cmosOptions[i].config_id;
+		memcpy(option->name, cmosOptions[i].name, strlen(cmosOptions[i].name));
+	}
+
+	for (i = 0; i < CMOS_ENUM_COUNT; i++) {
+		struct cmos_enums* option_enum = (struct cmos_enums*)addEntry(&record, LB_TAG_OPTION_ENUM, sizeof(struct cmos_enums));
+
+		option_enum->config_id = cmosEnums[i].config_id;
+		option_enum->value = cmosEnums[i].value;
+		memcpy(option_enum->text, cmosEnums[i].text, strlen(cmosEnums[i].text));
+	}
+
+	defaults = (struct cmos_defaults*)addEntry(&record, LB_TAG_OPTION_DEFAULTS, sizeof(struct cmos_defaults));
+	defaults->name_length = CMOS_MAX_NAME_LENGTH;
+	memcpy(defaults->name, "cmos_defaults", sizeof("cmos_defaults"));
+
+	for (i = 0; i < CMOS_OPTION_COUNT; i++) {
+		for (j = 0; j < cmosOptions[i].length; j++) {
+			UINT32 bit = cmosOptions[i].bit + j;
+
+			if ((cmosOptions[i].value >> j) & 1)
+				defaults->default_set[bit / 8] |= (UINT8)(1 << (bit % 8));
+		}
+	}
+}
+
+/* fills in the header of a table whose entries follow it */
+static void finishTable(struct coreboot_table_header* hdr, UINT32 table_bytes, UINT32 entries)
+{
+	memcpy(hdr->signature, "LBIO", 4);
+	hdr->header_bytes = sizeof(*hdr);
+	hdr->table_bytes = table_bytes;
+	hdr->table_entries = entries;
+	hdr->table_checksum = cb_fold_checksum(cb_sum_words(hdr + 1, table_bytes));
+	hdr->header_checksum = 0;
+	hdr->header_checksum = cb_fold_checksum(cb_sum_words(hdr, sizeof(*hdr)));
+}
+
+/* entries the table needs before padding */
+static UINT32 fixedEntries(const struct cbimage_config* config)
+{
+	return 2 + (config->options != 0) + (config->timestamps != 0) + (config->tcpa != 0);
+}
+
+static UINT32 tableBytes(const struct cbimage_config* config, UINT32 entries)
+{
+	UINT32 fixed = fixedEntries(config);
+	UINT32 refs = fixed - 1 - (config->options != 0);
+	UINT32 bytes = sizeof(struct lb_cbmem_ref) * refs + sizeof(struct lb_memory) + 4 * sizeof(struct lb_memory_range);
+
+	if (config->options)
+		bytes += optionTableBytes();
+	return bytes + (entries - fixed) * (UINT32)sizeof(struct lb_cbmem_entry);
+}
+
+int cbimage_build(const struct cbimage_config* config, struct cbimage* image)
+{
+	UINT32 entries = config->entries;
+	UINT64 table, console, timestamps = 0, tcpa = 0, end;
+	UINT32 table_bytes;
+	UINT8* p;
+	UINT32 i;
+
+	memset(image, 0, sizeof(*image));
+
+	if (!config->console_size || config->console_size > CBMC_CURSOR_MASK)
+		return -1;
+
+	if (entries < fixedEntries(config))
+		entries = fixedEntries(config);
+	table_bytes = tableBytes(config, entries);
+
+	table = config->forward ? CBIMAGE_HIGH_BASE : CBIMAGE_LOW_TABLE;
+	end = config->forward ? table + sizeof(struct coreboot_table_header) + table_bytes : CBIMAGE_HIGH_BASE;
+
+	console = ALIGN_UP(end, 0x1000);
+	end = console + sizeof(struct cbmem_console) + config->console_size;
+	if (config->timestamps) {
+		timestamps = ALIGN_UP(end, 0x1000);
+		end = timestamps + offsetof(struct timestamp_table, entries) + config->timestamps * sizeof(struct timestamp_entry);
+	}
+	if (config->tcpa) {
+		tcpa = ALIGN_UP(end, 0x1000);
+		end = tcpa + sizeof(struct tcpa_table) + config->tcpa * sizeof(struct tcpa_entry);
+	}
+	end = ALIGN_UP(end, 0x1000);
+
+	if (!config->forward && CBIMAGE_LOW_TABLE + sizeof(struct coreboot_table_header) + table_bytes > CBIMAGE_HIGH_BASE)
+		return -1;
+
+	image->data = calloc(1, (size_t)end);
+	if (!image->data)
+		return -1;
+
+	image->size = (size_t)end;
+	image->table = table;
+	image->console = console;
+	image->timestamps = timestamps;
+	image->tcpa = tcpa;
+
+	if (buildConsole(config, image, image->data + console)) {
+		cbimage_free(image);
+		return -1;
+	}
+	if (timestamps)
+		buildTimestamps(config, image->data + timestamps);
+	if (tcpa)
+		buildTcpa(config, image->data + tcpa);
+
+	p = image->data + table + sizeof(struct coreboot_table_header);
+
+	{
+		struct lb_memory* mem = (struct lb_memory*)addEntry(&p, LB_TAG_MEMORY,
+			sizeof(struct lb_memory) + 4 * sizeof(struct lb_memory_range));
+
+		setRange(&mem->map[0], 0, 0xa0000, LB_MEM_RAM);
+		setRange(&mem->map[1], 0xa0000, 0x60000, LB_MEM_RESERVED);
+		setRange(&mem->map[2], 0x100000, CBIMAGE_HIGH_BASE - 0x100000, LB_MEM_RAM);
+		setRange(&mem->map[3], CBIMAGE_HIGH_BASE, end - CBIMAGE_HIGH_BASE, LB_MEM_TABLE);
+	}
+
+	if (config->options)
+		addOptions(&p);
+
+	addRef(&p, LB_TAG_CBMEM_CONSOLE, console);
+	if (timestamps)
+		addRef(&p, LB_TAG_TIMESTAMPS, timestamps);
+	if (tcpa)
+		addRef(&p, LB_TAG_TCPA_LOG, tcpa);
+
+	for (i = fixedEntries(config); i < entries; i++) {
+		struct lb_cbmem_entry* cbmem = (struct lb_cbmem_entry*)addEntry(&p, LB_TAG_CBMEM_ENTRY, sizeof(struct lb_cbmem_entry));
+
+		cbmem->address = CBIMAGE_HIGH_BASE + (UINT64)i * 0x1000;
+		cbmem->entry_size = 0x1000;
+		cbmem->id = 0x5a000000 + i;
+	}
+
+	finishTable((struct coreboot_table_header*)(image->data + table), table_bytes, entries);
+
+	if (config->forward) {
+		UINT8* low = image->data + CBIMAGE_LOW_TABLE + sizeof(struct coreboot_table_header);
+		struct lb_forward* forward = (struct lb_forward*)addEntry(&low, LB_TAG_FORWARD, sizeof(struct lb_forward));
+
+		forward->forward = table;
+		finishTable((struct coreboot_table_header*)(image->data + CBIMAGE_LOW_TABLE), sizeof(*forward), 1);
+	}
+
+	return 0;
+}
+
+void cbimage_free(struct cbimage* image)
+{
+	free(image->data);
+	free(image->console_text);
+	memset(image, 0, sizeof(*image));
+}
+
+UINT64 cbimage_parse_size(const char* s)
+{
+	char* end;
+	unsigned long long value = strtoull(s, &end, 0);
+
+	switch (*end) {
+	case 'k': case 'K':
+		value <<= 10;
+		end++;
+		break;
+	case 'm': case 'M':
+		value <<= 20;
+		end++;
+		break;
+	case 'g': case 'G':
+		value <<= 30;
+		end++;
+		break;
+	default:
+		break;
+	}
+
+	return *end || end == s ? 0 : value;
+}
@@ -0,0 +1,59 @@
+#ifndef __CBIMAGE_H__
+#define __CBIMAGE_H__
+
+/*
+ * Synthetic coreboot memory images. An image stands in for physical
+ * memory from address 0: the tables and the CBMEM regions sit at their
+ * physical addresses as offsets into the image, laid out the way
+ * coreboot leaves them on x86.
+ *
+ *	0x500		low table, holding only LB_TAG_FORWARD when forward is set
+ *	0x200000	the table itself when forwarded, then the regions
+ */
+
+#include "cbparse.h"
+
+#define CBIMAGE_LOW_TABLE	0x500
+#define CBIMAGE_HIGH_BASE	0x200000
+
+/* line level markers current coreboot stores in front of every line */
+#define CBIMAGE_MARKER_NOTICE	0x15
+#define CBIMAGE_MARKER_DEBUG	0x17
+
+struct cbimage_config {
+	UINT32 entries;		/* table entries, padded with LB_TAG_CBMEM_ENTRY */
+	int forward;		/* put the table high behind a forward */
+	UINT32 console_size;	/* ring bytes */
+	int console_wrapped;	/* log 1.5 times the ring so it wraps */
+	int markers;		/* start lines with a level marker byte */
+	int options;		/* add a CMOS option table with defaults */
+	UINT16 timestamps;	/* max_entries, all in use; 0 for none */
+	UINT16 tcpa;		/* max_entries, all in use; 0 for none */
+	UINT32 seed;
+};
+
+struct cbimage {
+	UINT8* data;
+	size_t size;
+
+	UINT64 table;		/* the table with the entries */
+	UINT64 console;
+	UINT64 timestamps;	/* 0 if not present */
+	UINT64 tcpa;		/* 0 if not present */
+
+	/* console text oldest byte first, what cb_console_view should see */
+	UINT8* console_text;
+	UINT32 console_length;
+};
+
+void cbimage_defaults(struct cbimage_config* config);
+
+/* 0 on success, -1 if out of memory or the configuration is invalid */
+int cbimage_build(const struct cbimage_config* config, struct cbimage* image);
+
+void cbimage_free(struct cbimage* image);
+
+/* bytes from a size with an optional K, M or G suffix, 0 if invalid */
+UINT64 cbimage_parse_size(const char* s);
+
+#endif /* __CBIMAGE_H__ */
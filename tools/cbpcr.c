@@ -0,0 +1,242 @@
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "cbhash.h"
+
+/*
+ * Replays archived TCPA logs into PCR values with real SHA-1 and SHA-256,
+ * the way IOCTL_CBTABLE_REPLAY_PCRS does on the live log. Each file is an
+ * IOCTL_CBTABLE_SNAPSHOT image or a bare TCPA region, as returned by
+ * IOCTL_CBTABLE_READ_REGION or cbread -r tcpa. Files are spread over
+ * worker threads and the results printed in command line order.
+ */
+
+#define MAX_VALUES (CBTABLE_PCR_BANKS * CBTABLE_PCR_COUNT)
+
+static const char* bankNames[CBTABLE_PCR_BANKS] = {
+	"sha1",		/* CBTABLE_PCR_SHA1 */
+	"sha256",	/* CBTABLE_PCR_SHA256 */
+};
+
+struct job {
+	const char* path;
+	const char* error;	/* NULL once replayed */
+	UINT32 entries;
+	struct cbtable_pcr_replay* replay;
+};
+
+struct pool {
+	pthread_mutex_t lock;
+	struct job* jobs;
+	size_t count;
+	size_t next;
+};
+
+static void usage(void)
+{
+	fprintf(stderr,
+		"usage: cbpcr [-j threads] file...\n"
+		"  -j threads   worker threads (default: online CPUs, at most one per file)\n");
+	exit(2);
+}
+
+static UINT8* readFile(const char* path, size_t* size)
+{
+	FILE* in = fopen(path, "rb");
+	UINT8* data = NULL;
+	long length;
+
+	if (!in)
+		return NULL;
+
+	if (!fseek(in, 0, SEEK_END) && (length = ftell(in)) >= 0 && !fseek(in, 0, SEEK_SET)) {
+		data = malloc(length ? (size_t)length : 1);
+		if (data && fread(data, 1, (size_t)length, in) != (size_t)length) {
+			free(data);
+			data = NULL;
+		}
+		*size = (size_t)length;
+	}
+
+	fclose(in);
+	return data;
+}
+
+/*
+ * the TCPA payload of a snapshot, or NULL if the snapshot has none or its
+ * index points outside the file
+ */
+static UINT8* snapshotTcpa(UINT8* data, size_t size, size_t* tcpaSize)
+{
+	struct cbtable_snapshot_header* hdr = (struct cbtable_snapshot_header*)data;
+	UINT32 i;
+
+	if (size < sizeof(*hdr) || hdr->header_bytes < sizeof(*hdr) || hdr->header_bytes > size ||
+		(hdr->header_bytes - sizeof(*hdr)) / sizeof(hdr->regions[0]) < hdr->region_count)
+		return NULL;
+
+	for (i = 0; i < hdr->region_count; i++) {
+		struct cbtable_snapshot_region* region = &hdr->regions[i];
+
+		if (region->region != NextRequestTcpa)
+			continue;
+		if (region->offset > size || region->bytes > size - region->offset)
+			return NULL;
+
+		*tcpaSize = (size_t)region->bytes;
+		return data + region->offset;
+	}
+
+	return NULL;
+}
+
+static void replayFile(struct job* job)
+{
+	struct tcpa_table* tcpa_p;
+	size_t size, tcpaSize;
+	UINT8* data;
+	int result;
+
+	if (job->error)
+		return;
+
+	data = readFile(job->path, &size);
+	if (!data) {
+		job->error = "cannot read the file";
+		return;
+	}
+
+	if (size >= 4 && !memcmp(data, "CBSN", 4)) {
+		tcpa_p = (struct tcpa_table*)snapshotTcpa(data, size, &tcpaSize);
+		if (!tcpa_p) {
+			job->error = "snapshot without a valid TCPA region";
+			free(data);
+			return;
+		}
+	}
+	else {
+		tcpa_p = (struct tcpa_table*)data;
+		tcpaSize = size;
+	}
+
+	if (tcpaSize < sizeof(*tcpa_p)) {
+		job->error = "too short for a TCPA log";
+		free(data);
+		return;
+	}
+
+	job->entries = cb_tcpa_count(tcpa_p, tcpaSize);
+
+	result = cb_tcpa_replay(tcpa_p, job->entries, job->replay, MAX_VALUES, cbhash_extend, NULL);
+	if (result)
+		job->error = "replay failed";
+
+	free(data);
+}
+
+static void* worker(void* context)
+{
+	struct pool* pool = context;
+
+	for (;;) {
+		struct job* job;
+
+		pthread_mutex_lock(&pool->lock);
+		job = pool->next < pool->count ? &pool->jobs[pool->next++] : NULL;
+		pthread_mutex_unlock(&pool->lock);
+
+		if (!job)
+			return NULL;
+		replayFile(job);
+	}
+}
+
+static void printJob(const struct job* job)
+{
+	UINT32 v, i;
+
+	if (job->error) {
+		fprintf(stderr, "cbpcr: %s: %s\n", job->path, job->error);
+		return;
+	}
+
+	printf("%s: %u entries, %u skipped\n", job->path, job->entries, job->replay->skipped);
+	for (v = 0; v < job->replay->count; v++) {
+		const struct cbtable_pcr_value* value = &job->replay->pcrs[v];
+
+		printf("  pcr %2u %-6s ", value->pcr, bankNames[value->algorithm]);
+		for (i = 0; i < value->digest_length; i++)
+			printf("%02x", value->digest[i]);
+		printf("  %u\n", value->entries);
+	}
+}
+
+int main(int argc, char** argv)
+{
+	struct pool pool;
+	pthread_t* threads;
+	long threadCount = sysconf(_SC_NPROCESSORS_ONLN);
+	size_t started = 0, i;
+	int failed = 0;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "j:")) != -1) {
+		switch (opt) {
+		case 'j':
+			threadCount = strtol(optarg, NULL, 0);
+			if (threadCount < 1)
+				usage();
+			break;
+		default:
+			usage();
+		}
+	}
+
+	if (optind == argc)
+		usage();
+
+	memset(&pool, 0, sizeof(pool));
+	pool.count = (size_t)(argc - optind);
+	pool.jobs = calloc(pool.count, sizeof(pool.jobs[0]));
+	if (threadCount < 1)
+		threadCount = 1;
+	if ((size_t)threadCount > pool.count)
+		threadCount = (long)pool.count;
+	threads = calloc((size_t)threadCount, sizeof(threads[0]));
+	if (!pool.jobs || !threads) {
+		fprintf(stderr, "cbpcr: out of memory\n");
+		return 1;
+	}
+
+	for (i = 0; i < pool.count; i++) {
+		pool.jobs[i].path = argv[optind + i];
+		pool.jobs[i].replay = malloc(sizeof(struct cbtable_pcr_replay) + MAX_VALUES * sizeof(struct cbtable_pcr_value));
+		if (!pool.jobs[i].replay)
+			pool.jobs[i].error = "out of memory";
+	}
+
+	pthread_mutex_init(&pool.lock, NULL);
+
+	while (started + 1 < (size_t)threadCount && !pthread_create(&threads[started], NULL, worker, &pool))
+		started++;
+
+	/* the calling thread is the last worker, which also covers a failed create */
+	worker(&pool);
+	for (i = 0; i < started; i++)
+		pthread_join(threads[i], NULL);
+
+	for (i = 0; i < pool.count; i++) {
+		printJob(&pool.jobs[i]);
+		if (pool.jobs[i].error)
+			failed = 1;
+		free(pool.jobs[i].replay);
+	}
+
+	pthread_mutex_destroy(&pool.lock);
+	free(pool.jobs);
+	free(threads);
+	return failed;
+}
@@ -0,0 +1,172 @@
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "cbsource.h"
+
+/*
+ * Reads the coreboot table regions of this machine through /dev/mem, or
+ * of an image written by cbgen, the same way IOCTL_CBTABLE_READ_REGION
+ * does on Windows. A region is written to stdout, or region reads are
+ * served on a Unix socket, see cbsource.h for the protocol.
+ */
+
+static const char* regionNames[NextRequestReserved] = {
+	"console",	/* NextRequestConsole */
+	"timestamps",	/* NextRequestTimestamps */
+	"root",		/* NextRequestRoot */
+	"tcpa",		/* NextRequestTcpa */
+};
+
+static void usage(void)
+{
+	fprintf(stderr,
+		"usage: cbread [options]\n"
+		"  -i image     read a memory image instead of " CBSOURCE_DEVMEM "\n"
+		"  -r region    console, timestamps, root or tcpa (default console)\n"
+		"  -l           list where the table and its regions are\n"
+		"  -s socket    serve region reads on a Unix socket\n");
+	exit(2);
+}
+
+static int parseRegion(const char* name, UINT32* region)
+{
+	for (*region = 0; *region < NextRequestReserved; (*region)++) {
+		if (!strcmp(name, regionNames[*region]))
+			return 0;
+	}
+	return -1;
+}
+
+static void listRegions(struct cbsource* source)
+{
+	UINT32 region;
+
+	printf("low table  0x%llx\n", (unsigned long long)source->low_table);
+	for (region = 0; region < NextRequestReserved; region++) {
+		struct cbsource_region* r = &source->regions[region];
+
+		if (!r->data) {
+			printf("%-10s not present\n", regionNames[region]);
+			continue;
+		}
+
+		printf("%-10s 0x%llx, %zu bytes mapped, %zu in use\n", regionNames[region],
+			(unsigned long long)r->address, r->size, cb_region_length(region, r->data, r->size));
+	}
+}
+
+static int dumpRegion(struct cbsource* source, UINT32 region)
+{
+	static UINT8 buf[64 << 10];
+	UINT64 offset = 0;
+	size_t got;
+
+	if (!source->regions[region].data) {
+		fprintf(stderr, "cbread: the table has no %s region\n", regionNames[region]);
+		return 1;
+	}
+
+	do {
+		got = cbsource_read(source, region, offset, buf, sizeof(buf));
+		if (fwrite(buf, 1, got, stdout) != got) {
+			perror("cbread: stdout");
+			return 1;
+		}
+		offset += got;
+	} while (got == sizeof(buf));
+
+	return 0;
+}
+
+/* one forked server per connection, all sharing the parent's mappings */
+static int serve(struct cbsource* source, const char* path)
+{
+	struct sockaddr_un addr;
+	int listener;
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	if (strlen(path) >= sizeof(addr.sun_path)) {
+		fprintf(stderr, "cbread: socket path too long\n");
+		return 1;
+	}
+	strcpy(addr.sun_path, path);
+
+	listener = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	unlink(path);
+	if (listener < 0 || bind(listener, (struct sockaddr*)&addr, sizeof(addr)) || listen(listener, 16)) {
+		perror(path);
+		return 1;
+	}
+
+	signal(SIGCHLD, SIG_IGN);
+
+	for (;;) {
+		int fd = accept(listener, NULL, NULL);
+
+		if (fd < 0)
+			continue;
+
+		if (fork() == 0) {
+			close(listener);
+			_exit(cbsource_serve(source, fd) ? 1 : 0);
+		}
+		close(fd);
+	}
+}
+
+int main(int argc, char** argv)
+{
+	struct cbsource source;
+	const char* path = CBSOURCE_DEVMEM;
+	const char* socketPath = NULL;
+	UINT32 region = NextRequestConsole;
+	int list = 0;
+	int result;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "i:r:ls:")) != -1) {
+		switch (opt) {
+		case 'i':
+			path = optarg;
+			break;
+		case 'r':
+			if (parseRegion(optarg, &region))
+				usage();
+			break;
+		case 'l':
+			list = 1;
+			break;
+		case 's':
+			socketPath = optarg;
+			break;
+		default:
+			usage();
+		}
+	}
+
+	if (optind != argc)
+		usage();
+
+	if (cbsource_open(&source, path))
+		return 1;
+
+	if (list) {
+		listRegions(&source);
+		result = 0;
+	}
+	else if (socketPath) {
+		result = serve(&source, socketPath);
+	}
+	else {
+		result = dumpRegion(&source, region);
+	}
+
+	cbsource_close(&source);
+	return result;
+}
@@ -0,0 +1,301 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "cbsource.h"
+
+/* where coreboot leaves the low table, searched on 16 byte boundaries */
+static const struct {
+	UINT64 start;
+	UINT64 end;
+} scanRanges[] = {
+	{ 0, 0x1000 },
+	{ 0xf0000, 0x100000 },
+};
+
+static int inSource(struct cbsource* source, UINT64 address, size_t len)
+{
+	return !source->limit || (address <= source->limit && len <= source->limit - address);
+}
+
+static int readAt(struct cbsource* source, UINT64 address, void* out, size_t len)
+{
+	if (!inSource(source, address, len))
+		return -1;
+
+	return pread(source->fd, out, len, (off_t)address) == (ssize_t)len ? 0 : -1;
+}
+
+/* reads a whole table at address, header first to learn its size */
+static struct coreboot_table_header* readTable(struct cbsource* source, UINT64 address, UINT8** buf)
+{
+	struct coreboot_table_header hdr;
+	size_t size;
+
+	*buf = NULL;
+	if (readAt(source, address, &hdr, sizeof(hdr)) || memcmp(hdr.signature, "LBIO", 4) ||
+		hdr.header_bytes < sizeof(hdr))
+		return NULL;
+
+	size = (size_t)hdr.header_bytes + hdr.table_bytes;
+	*buf = malloc(size);
+	if (!*buf || readAt(source, address, *buf, size))
+		return NULL;
+
+	return cb_table_valid(*buf, size);
+}
+
+static UINT64 scanTable(struct cbsource* source)
+{
+	size_t r;
+
+	for (r = 0; r < sizeof(scanRanges) / sizeof(scanRanges[0]); r++) {
+		size_t len = (size_t)(scanRanges[r].end - scanRanges[r].start);
+		UINT8* buf = malloc(len);
+		size_t off;
+
+		if (!buf)
+			return 0;
+		if (readAt(source, scanRanges[r].start, buf, len)) {
+			free(buf);
+			continue;
+		}
+
+		for (off = 0; off + sizeof(struct coreboot_table_header) <= len; off += 16) {
+			if (cb_table_valid(buf + off, len - off)) {
+				free(buf);
+				return scanRanges[r].start + off;
+			}
+		}
+
+		free(buf);
+	}
+
+	return 0;
+}
+
+static int mapRegion(struct cbsource* source, UINT32 region, UINT64 address, size_t size)
+{
+	struct cbsource_region* r = &source->regions[region];
+	UINT64 page = (UINT64)sysconf(_SC_PAGESIZE);
+	UINT64 base = address & ~(page - 1);
+	size_t span = (size_t)(address - base) + size;
+	void* map;
+
+	if (!size || !inSource(source, address, size))
+		return -1;
+
+	map = mmap(NULL, span, PROT_READ, MAP_SHARED, source->fd, (off_t)base);
+	if (map == MAP_FAILED)
+		return -1;
+
+	r->address = address;
+	r->data = (UINT8*)map + (address - base);
+	r->size = size;
+	r->map = map;
+	r->map_size = span;
+	return 0;
+}
+
+/*
+ * bytes of a CBMEM region as the driver maps it: the whole console ring,
+ * and room for max_entries timestamps or TCPA records. 0 if unreadable.
+ */
+static size_t regionSize(struct cbsource* source, UINT32 region, UINT64 address)
+{
+	switch (region) {
+	case NextRequestConsole: {
+		struct cbmem_console console;
+
+		if (readAt(source, address, &console, sizeof(console)))
+			return 0;
+		return sizeof(console) + console.size;
+	}
+	case NextRequestTimestamps: {
+		struct timestamp_table timestamps;
+		UINT32 count;
+
+		if (readAt(source, address, &timestamps, sizeof(timestamps)))
+			return 0;
+		count = timestamps.max_entries > timestamps.num_entries ? timestamps.max_entries : timestamps.num_entries;
+		return sizeof(timestamps) + (size_t)count * sizeof(timestamps.entries[0]);
+	}
+	case NextRequestTcpa: {
+		struct tcpa_table tcpa;
+		UINT32 count;
+
+		if (readAt(source, address, &tcpa, sizeof(tcpa)))
+			return 0;
+		count = tcpa.max_entries > tcpa.num_entries ? tcpa.max_entries : tcpa.num_entries;
+		return sizeof(tcpa) + (size_t)count * sizeof(tcpa.entries[0]);
+	}
+	default:
+		return 0;
+	}
+}
+
+static void mapCbmem(struct cbsource* source, struct coreboot_table_header* hdr, UINT32 tag, UINT32 region)
+{
+	struct lb_cbmem_ref* ref = CB_ENTRY_VIEW(cb_find_entry(hdr, tag), struct lb_cbmem_ref);
+
+	if (!ref || !ref->cbmem_addr)
+		return;
+
+	if (mapRegion(source, region, ref->cbmem_addr, regionSize(source, region, ref->cbmem_addr)))
+		fprintf(stderr, "cbread: cannot map region %u at 0x%llx\n", region, (unsigned long long)ref->cbmem_addr);
+}
+
+int cbsource_open(struct cbsource* source, const char* path)
+{
+	struct coreboot_table_header* hdr;
+	struct lb_forward* forward;
+	struct stat st;
+	UINT64 table;
+	size_t size;
+	UINT8* buf;
+
+	memset(source, 0, sizeof(*source));
+
+	source->fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (source->fd < 0 || fstat(source->fd, &st)) {
+		perror(path);
+		if (source->fd >= 0)
+			close(source->fd);
+		return -1;
+	}
+	if (S_ISREG(st.st_mode))
+		source->limit = (UINT64)st.st_size;
+
+	source->low_table = scanTable(source);
+	if (!source->low_table) {
+		fprintf(stderr, "cbread: no coreboot table in %s\n", path);
+		cbsource_close(source);
+		return -1;
+	}
+
+	table = source->low_table;
+	hdr = readTable(source, table, &buf);
+	forward = hdr ? CB_ENTRY_VIEW(cb_find_entry(hdr, LB_TAG_FORWARD), struct lb_forward) : NULL;
+	if (forward)
+		table = forward->forward;
+	free(buf);
+
+	hdr = readTable(source, table, &buf);
+	size = hdr ? (size_t)hdr->header_bytes + hdr->table_bytes : 0;
+	free(buf);
+	if (!size || mapRegion(source, NextRequestRoot, table, size)) {
+		fprintf(stderr, "cbread: cannot map the coreboot table at 0x%llx\n", (unsigned long long)table);
+		cbsource_close(source);
+		return -1;
+	}
+
+	/* the mapping is what gets served, so parse that rather than the copy */
+	hdr = cb_table_valid(source->regions[NextRequestRoot].data, source->regions[NextRequestRoot].size);
+	if (!hdr) {
+		fprintf(stderr, "cbread: coreboot table at 0x%llx changed while mapping it\n", (unsigned long long)table);
+		cbsource_close(source);
+		return -1;
+	}
+
+	mapCbmem(source, hdr, LB_TAG_CBMEM_CONSOLE, NextRequestConsole);
+	mapCbmem(source, hdr, LB_TAG_TIMESTAMPS, NextRequestTimestamps);
+	mapCbmem(source, hdr, LB_TAG_TCPA_LOG, NextRequestTcpa);
+	return 0;
+}
+
+void cbsource_close(struct cbsource* source)
+{
+	UINT32 region;
+
+	for (region = 0; region < NextRequestReserved; region++) {
+		if (source->regions[region].map)
+			munmap(source->regions[region].map, source->regions[region].map_size);
+	}
+
+	if (source->fd >= 0)
+		close(source->fd);
+	memset(source, 0, sizeof(*source));
+	source->fd = -1;
+}
+
+size_t cbsource_read(struct cbsource* source, UINT32 region, UINT64 offset, void* out, size_t len)
+{
+	if (region >= NextRequestReserved || !source->regions[region].data)
+		return 0;
+
+	return cb_region_read(region, source->regions[region].data, source->regions[region].size, offset, out, len);
+}
+
+/* 1 once len bytes are in, 0 on a close before the first byte, -1 otherwise */
+static int recvAll(int fd, void* buf, size_t len)
+{
+	size_t done = 0;
+
+	while (done < len) {
+		ssize_t got = recv(fd, (UINT8*)buf + done, len - done, 0);
+
+		if (got < 0 && errno == EINTR)
+			continue;
+		if (got <= 0)
+			return !got && !done ? 0 : -1;
+		done += (size_t)got;
+	}
+	return 1;
+}
+
+static int sendAll(int fd, const void* buf, size_t len)
+{
+	size_t done = 0;
+
+	while (done < len) {
+		ssize_t sent = send(fd, (const UINT8*)buf + done, len - done, MSG_NOSIGNAL);
+
+		if (sent < 0 && errno == EINTR)
+			continue;
+		if (sent <= 0)
+			return -1;
+		done += (size_t)sent;
+	}
+	return 0;
+}
+
+int cbsource_serve(struct cbsource* source, int fd)
+{
+	struct cbread_request request;
+	struct cbread_reply reply;
+	UINT8* buf = malloc(CBREAD_MAX_LENGTH);
+	int result = -1;
+
+	if (!buf)
+		return -1;
+
+	for (;;) {
+		int got = recvAll(fd, &request, sizeof(request));
+
+		if (got <= 0) {
+			result = got;
+			break;
+		}
+
+		memset(&reply, 0, sizeof(reply));
+		if (request.region >= NextRequestReserved)
+			reply.status = CBREAD_BAD_REGION;
+		else if (!source->regions[request.region].data)
+			reply.status = CBREAD_NOT_PRESENT;
+		else
+			reply.length = cbsource_read(source, request.region, request.offset, buf,
+				request.length < CBREAD_MAX_LENGTH ? (size_t)request.length : CBREAD_MAX_LENGTH);
+
+		if (sendAll(fd, &reply, sizeof(reply)) || sendAll(fd, buf, (size_t)reply.length))
+			break;
+	}
+
+	free(buf);
+	return result;
+}
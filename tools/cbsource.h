@@ -0,0 +1,68 @@
+#ifndef __CBSOURCE_H__
+#define __CBSOURCE_H__
+
+/*
+ * The coreboot table of a machine, read the way the driver reads it but
+ * from /dev/mem or from a memory image such as cbgen writes. The table is
+ * found by scanning the low memory ranges coreboot uses and following
+ * LB_TAG_FORWARD. Each region is then mapped once, sized like the driver
+ * sizes its mappings, and read with cb_region_read.
+ */
+
+#include "cbparse.h"
+
+#define CBSOURCE_DEVMEM "/dev/mem"
+
+struct cbsource_region {
+	UINT64 address;		/* 0 if the table has no such region */
+	UINT8* data;
+	size_t size;
+
+	void* map;		/* page aligned mapping holding data */
+	size_t map_size;
+};
+
+struct cbsource {
+	int fd;
+	UINT64 limit;		/* bytes in an image file, 0 for a device */
+	UINT64 low_table;	/* where the scan found a table */
+	struct cbsource_region regions[NextRequestReserved];
+};
+
+/* 0 on success, -1 with a message on stderr */
+int cbsource_open(struct cbsource* source, const char* path);
+
+void cbsource_close(struct cbsource* source);
+
+/* cb_region_read on a mapped region, 0 bytes for one that isn't present */
+size_t cbsource_read(struct cbsource* source, UINT32 region, UINT64 offset, void* out, size_t len);
+
+/*
+ * Region reads over a stream socket. Each struct cbread_request is
+ * answered with a struct cbread_reply followed by length bytes of the
+ * region, which end the region once fewer than requested come back.
+ */
+
+#define CBREAD_MAX_LENGTH	(1 << 20)
+
+#define CBREAD_OK		0
+#define CBREAD_BAD_REGION	1
+#define CBREAD_NOT_PRESENT	2
+
+struct cbread_request {
+	UINT32 region;		/* enum NextRequest */
+	UINT32 reserved;
+	UINT64 offset;
+	UINT64 length;		/* clamped to CBREAD_MAX_LENGTH */
+};
+
+struct cbread_reply {
+	UINT32 status;		/* CBREAD_* */
+	UINT32 reserved;
+	UINT64 length;
+};
+
+/* answers requests on fd until the peer closes it; 0, or -1 on an error */
+int cbsource_serve(struct cbsource* source, int fd);
+
+#endif /* __CBSOURCE_H__ */
@@ -0,0 +1,888 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "cbhash.h"
+#include "cbimage.h"
+#include "cbsource.h"
+
+/*
+ * Checks of cbparse.h against synthetic images. Each test returns the
+ * number of failed checks.
+ */
+
+#define CHECK(cond) \
+	do { \
+		if (!(cond)) { \
+			fprintf(stderr, "%s:%d: %s: check failed: %s\n", __FILE__, __LINE__, __func__, #cond); \
+			failures++; \
+		} \
+	} while (0)
+
+/*
+ * cb_sum_words_sse2 against cb_sum_words on odd lengths, lengths below
+ * one 16 word block and unaligned starts
+ */
+static int testChecksum(void)
+{
+	int failures = 0;
+#if defined(CB_HAVE_SSE2)
+	static const size_t large[] = { 4096, 4097, 65535, 65536 + 30, 1 << 20 };
+	size_t room = (1 << 20) + 64;
+	UINT8* buf = malloc(room);
+	UINT32 state = 7;
+	size_t i, offset, len;
+
+	CHECK(buf != NULL);
+	if (!buf)
+		return failures;
+
+	for (i = 0; i < room; i++) {
+		state = state * 1103515245u + 12345u;
+		buf[i] = (UINT8)(state >> 16);
+	}
+
+	for (offset = 0; offset < 4; offset++) {
+		for (len = 0; len <= 72; len++)
+			CHECK(cb_sum_words_sse2(buf + offset, len) == cb_sum_words(buf + offset, len));
+
+		for (i = 0; i < sizeof(large) / sizeof(large[0]); i++)
+			CHECK(cb_sum_words_sse2(buf + offset, large[i]) == cb_sum_words(buf + offset, large[i]));
+	}
+
+	/* all ones makes every lane wrap */
+	memset(buf, 0xff, room);
+	CHECK(cb_sum_words_sse2(buf, 1 << 20) == cb_sum_words(buf, 1 << 20));
+	CHECK(cb_sum_words_sse2(buf + 1, (1 << 20) - 1) == cb_sum_words(buf + 1, (1 << 20) - 1));
+
+	free(buf);
+#endif
+	return failures;
+}
+
+static int testTable(void)
+{
+	struct cbimage_config config;
+	struct cbimage image;
+	struct coreboot_table_header* low;
+	struct coreboot_table_header* hdr;
+	struct lb_forward* forward;
+	struct lb_cbmem_ref* ref;
+	struct coreboot_table_entry* entry;
+	struct cb_entry_iter it;
+	UINT32 count = 0;
+	int failures = 0;
+
+	cbimage_defaults(&config);
+	config.entries = 100;
+	CHECK(!cbimage_build(&config, &image));
+
+	low = cb_table_valid(image.data + CBIMAGE_LOW_TABLE, image.size - CBIMAGE_LOW_TABLE);
+	CHECK(low != NULL);
+	forward = low ? CB_ENTRY_VIEW(cb_find_entry(low, LB_TAG_FORWARD), struct lb_forward) : NULL;
+	CHECK(forward && forward->forward == image.table);
+
+	hdr = cb_table_valid(image.data + image.table, image.size - (size_t)image.table);
+	CHECK(hdr != NULL);
+	if (hdr) {
+		cb_for_each_entry(entry, it, hdr)
+			count++;
+		CHECK(count == 100);
+
+		ref = CB_ENTRY_VIEW(cb_find_entry(hdr, LB_TAG_CBMEM_CONSOLE), struct lb_cbmem_ref);
+		CHECK(ref && ref->cbmem_addr == image.console);
+		ref = CB_ENTRY_VIEW(cb_find_entry(hdr, LB_TAG_TIMESTAMPS), struct lb_cbmem_ref);
+		CHECK(ref && ref->cbmem_addr == image.timestamps);
+		ref = CB_ENTRY_VIEW(cb_find_entry(hdr, LB_TAG_TCPA_LOG), struct lb_cbmem_ref);
+		CHECK(ref && ref->cbmem_addr == image.tcpa);
+
+		/* a flipped byte fails the checksum, a short buffer the header */
+		image.data[image.table + hdr->header_bytes + 3] ^= 1;
+		CHECK(cb_table_valid(hdr, image.size - (size_t)image.table) == NULL);
+		CHECK(cb_table_header(hdr, sizeof(*hdr) + 8) == NULL);
+	}
+
+	cbimage_free(&image);
+	return failures;
+}
+
+/* whole and chunked reads of the console against the generated text */
+static int checkConsole(UINT32 size, int wrapped)
+{
+	struct cbimage_config config;
+	struct cbimage image;
+	struct cbmem_console* console_p;
+	size_t mapped, total, chunk;
+	UINT8* whole;
+	UINT8* pieces;
+	int failures = 0;
+
+	cbimage_defaults(&config);
+	config.console_size = size;
+	config.console_wrapped = wrapped;
+	if (cbimage_build(&config, &image)) {
+		CHECK(!"cbimage_build");
+		return failures;
+	}
+
+	console_p = (struct cbmem_console*)(image.data + image.console);
+	mapped = sizeof(*console_p) + size;
+	total = sizeof(*console_p) + image.console_length;
+
+	CHECK(!!(console_p->cursor & CBMC_OVERFLOW) == wrapped);
+	CHECK(cb_region_length(NextRequestConsole, console_p, mapped) == total);
+
+	whole = malloc(total + 16);
+	pieces = malloc(total + 16);
+	CHECK(whole && pieces);
+	if (!whole || !pieces) {
+		free(whole);
+		free(pieces);
+		cbimage_free(&image);
+		return failures;
+	}
+
+	CHECK(cb_region_read(NextRequestConsole, console_p, mapped, 0, whole, total + 16) == total);
+	CHECK(!memcmp(whole, console_p, sizeof(*console_p)));
+	CHECK(!memcmp(whole + sizeof(*console_p), image.console_text, image.console_length));
+	CHECK(cb_region_read(NextRequestConsole, console_p, mapped, total, whole, 16) == 0);
+
+	for (chunk = 1; chunk <= 4097; chunk = chunk * 7 + 3) {
+		UINT64 offset = 0;
+		size_t got;
+
+		if (total / chunk > 100000)
+			continue;
+
+		do {
+			got = cb_region_read(NextRequestConsole, console_p, mapped, offset, pieces + offset, chunk);
+			offset += got;
+		} while (got == chunk);
+
+		CHECK(offset == total);
+		CHECK(!memcmp(whole, pieces, total));
+	}
+
+	free(whole);
+	free(pieces);
+	cbimage_free(&image);
+	return failures;
+}
+
+static int testConsole(void)
+{
+	int failures = 0;
+
+	failures += checkConsole(4096, 0);
+	failures += checkConsole(4096, 1);
+	failures += checkConsole(64 << 10, 0);
+	failures += checkConsole(64 << 10, 1);
+	failures += checkConsole(1 << 20, 1);
+	return failures;
+}
+
+/* stage of a line written at ring position start of a ring of size bytes */
+static UINT32 lineStage(const char* line, UINT32 size, UINT32 start)
+{
+	UINT8 ring[128];
+	struct cb_console_text text;
+	UINT32 len = (UINT32)strlen(line), i;
+
+	memset(ring, '.', sizeof(ring));
+	for (i = 0; i < len; i++)
+		ring[(start + i) % size] = (UINT8)line[i];
+
+	text.ring = ring;
+	text.size = size;
+	text.start = start;
+	text.length = len;
+	text.cursor = start | CBMC_OVERFLOW;
+	return cb_console_line_stage(&text, 0, len);
+}
+
+/* stages in the order their banners appear in a generated console */
+static UINT32 imageStages(UINT32 size, int wrapped, int markers, UINT32* stages, UINT32 room)
+{
+	struct cbimage_config config;
+	struct cbimage image;
+	struct cb_console_text text;
+	UINT32 found = 0, line = 0, i;
+
+	cbimage_defaults(&config);
+	config.console_size = size;
+	config.console_wrapped = wrapped;
+	config.markers = markers;
+	if (cbimage_build(&config, &image))
+		return 0;
+
+	cb_console_view((struct cbmem_console*)(image.data + image.console), sizeof(struct cbmem_console) + size, &text);
+
+	for (i = 0; i < text.length; i++) {
+		UINT32 stage;
+
+		if (text.ring[cb_console_pos(&text, i)] != '\n')
+			continue;
+
+		stage = cb_console_line_stage(&text, line, i - line);
+		if (stage && found < room)
+			stages[found++] = stage;
+		line = i + 1;
+	}
+
+	cbimage_free(&image);
+	return found;
+}
+
+static int testConsoleStages(void)
+{
+	static const char* ramstage = "coreboot-4.22 Fri Jan 12 10:00:00 UTC 2024 ramstage starting (log level: 7)...";
+	char line[128];
+	UINT32 stages[16];
+	UINT32 count, i;
+	int failures = 0;
+	int markers;
+
+	/* bare banners and banners behind each marker level */
+	CHECK(lineStage(ramstage, 128, 0) == CBTABLE_STAGE_RAMSTAGE);
+	for (i = CBMC_LOG_MARKER_FIRST; i <= CBMC_LOG_MARKER_LAST; i++) {
+		snprintf(line, sizeof(line), "%c%s", (int)i, ramstage);
+		CHECK(lineStage(line, 128, 0) == CBTABLE_STAGE_RAMSTAGE);
+	}
+	CHECK(lineStage("\x15Jumping to boot code at 0x00800000(0x7ffff000)", 128, 0) == CBTABLE_STAGE_PAYLOAD);
+	CHECK(lineStage("\x17" "coreboot-4.22 bootblock starting...", 128, 0) == CBTABLE_STAGE_BOOTBLOCK);
+
+	/* one marker byte is skipped, anything else in front is not */
+	snprintf(line, sizeof(line), "%c%s", CBMC_LOG_MARKER_LAST + 1, ramstage);
+	CHECK(lineStage(line, 128, 0) == 0);
+	snprintf(line, sizeof(line), "\x15\x15%s", ramstage);
+	CHECK(lineStage(line, 128, 0) == 0);
+	snprintf(line, sizeof(line), " %s", ramstage);
+	CHECK(lineStage(line, 128, 0) == 0);
+	CHECK(lineStage("\x15" "coreboot-4.22 ramstage", 128, 0) == 0);
+	CHECK(lineStage("\x15PCI: 00:1f.3 enabled", 128, 0) == 0);
+	CHECK(lineStage("\x15", 128, 0) == 0);
+
+	/* lines split by the end of the ring, after the marker and mid-word */
+	for (i = 40; i < 48; i++)
+		CHECK(lineStage("\x15" "coreboot-4.22 postcar starting", 48, i) == CBTABLE_STAGE_POSTCAR);
+	CHECK(lineStage("\x16Jumping to boot code", 32, 31) == CBTABLE_STAGE_PAYLOAD);
+	CHECK(lineStage("\x16Jumping to boot code", 32, 30) == CBTABLE_STAGE_PAYLOAD);
+
+	/* a whole console finds every stage in order, with or without markers */
+	for (markers = 0; markers < 2; markers++) {
+		count = imageStages(64 << 10, 0, markers, stages, 16);
+		CHECK(count == 6);
+		for (i = 0; i < count && count == 6; i++)
+			CHECK(stages[i] == CBTABLE_STAGE_BOOTBLOCK + i);
+
+		/* a wrapped one has lost the early banners but keeps the order */
+		count = imageStages(4096, 1, markers, stages, 16);
+		CHECK(count >= 2 && count < 6);
+		for (i = 1; i < count; i++)
+			CHECK(stages[i] == stages[i - 1] + 1);
+		CHECK(count && stages[count - 1] == CBTABLE_STAGE_PAYLOAD);
+	}
+
+	return failures;
+}
+
+/* nothing is read from a buffer too short for the header it is asked about */
+static int testShortBuffers(void)
+{
+	struct {
+		struct cbmem_console console;
+		UINT8 text[64];
+	} console_buf;
+	struct cb_console_text text;
+	UINT8 out[128];
+	int failures = 0;
+
+	memset(&console_buf, 'x', sizeof(console_buf));
+	console_buf.console.size = sizeof(console_buf.text);
+	console_buf.console.cursor = 10;
+
+	CHECK(cb_console_length(&console_buf.console, sizeof(console_buf)) == 10);
+	CHECK(cb_console_cursor_length(&console_buf.console, 20, sizeof(console_buf)) == 20);
+	CHECK(cb_console_cursor_length(&console_buf.console, 20 | CBMC_OVERFLOW, sizeof(console_buf)) == sizeof(console_buf.text));
+	CHECK(cb_console_length(&console_buf.console, sizeof(console_buf.console) - 1) == 0);
+	CHECK(cb_region_read(NextRequestConsole, &console_buf, 4, 0, out, sizeof(out)) == 0);
+	CHECK(cb_region_length(NextRequestConsole, &console_buf, 4) == 0);
+
+	cb_console_view(&console_buf.console, 4, &text);
+	CHECK(text.length == 0 && text.size == 0);
+
+	/* a ring larger than the mapping is clamped to it */
+	console_buf.console.size = 1 << 20;
+	console_buf.console.cursor = 5 | CBMC_OVERFLOW;
+	cb_console_view(&console_buf.console, sizeof(console_buf), &text);
+	CHECK(text.size == sizeof(console_buf.text));
+	CHECK(text.length == sizeof(console_buf.text));
+	CHECK(text.start == 5);
+
+	CHECK(cb_timestamp_count((struct timestamp_table*)&console_buf, 8) == 0);
+	CHECK(cb_tcpa_count((struct tcpa_table*)&console_buf, 2) == 0);
+	return failures;
+}
+
+static int testRegions(void)
+{
+	struct cbimage_config config;
+	struct cbimage image;
+	struct timestamp_table* timestamp_p;
+	struct tcpa_table* tcpa_p;
+	size_t size;
+	int failures = 0;
+
+	cbimage_defaults(&config);
+	config.timestamps = 1000;
+	config.tcpa = 50;
+	CHECK(!cbimage_build(&config, &image));
+
+	timestamp_p = (struct timestamp_table*)(image.data + image.timestamps);
+	size = image.size - (size_t)image.timestamps;
+	CHECK(cb_timestamp_count(timestamp_p, size) == 1000);
+	CHECK(cb_region_length(NextRequestTimestamps, timestamp_p, size) ==
+		offsetof(struct timestamp_table, entries) + 1000 * sizeof(struct timestamp_entry));
+	CHECK(cb_timestamp_count(timestamp_p, offsetof(struct timestamp_table, entries) + 10 * sizeof(struct timestamp_entry) + 5) == 10);
+
+	tcpa_p = (struct tcpa_table*)(image.data + image.tcpa);
+	size = image.size - (size_t)image.tcpa;
+	CHECK(cb_tcpa_count(tcpa_p, size) == 50);
+	CHECK(cb_region_length(NextRequestTcpa, tcpa_p, size) == sizeof(*tcpa_p) + 50 * sizeof(struct tcpa_entry));
+
+	cbimage_free(&image);
+	return failures;
+}
+
+/* stand-in for H(pcr || digest), order sensitive like the real one */
+static int fakeExtend(void* context, UINT32 bank, UINT8* pcr, const UINT8* digest, UINT32 len)
+{
+	UINT32* calls = context;
+	UINT32 i;
+
+	(*calls)++;
+	for (i = 0; i < len; i++)
+		pcr[i] = (UINT8)(pcr[i] * 31 + digest[i] + bank);
+	return 0;
+}
+
+static int failingExtend(void* context, UINT32 bank, UINT8* pcr, const UINT8* digest, UINT32 len)
+{
+	(void)context;
+	(void)bank;
+	(void)pcr;
+	(void)digest;
+	(void)len;
+	return 5;
+}
+
+static int testTcpaReplay(void)
+{
+	struct cbimage_config config;
+	struct cbimage image;
+	struct tcpa_table* tcpa_p;
+	struct cbtable_pcr_replay* out;
+	UINT32 count, calls = 0, i, j, v;
+	size_t room = 64;
+	int failures = 0;
+
+	cbimage_defaults(&config);
+	config.tcpa = 50;
+	CHECK(!cbimage_build(&config, &image));
+	out = malloc(sizeof(*out) + room * sizeof(out->pcrs[0]));
+	CHECK(out != NULL);
+	if (!out) {
+		cbimage_free(&image);
+		return failures;
+	}
+
+	/* one entry past the PCRs and one of an unknown digest size */
+	tcpa_p = (struct tcpa_table*)(image.data + image.tcpa);
+	count = cb_tcpa_count(tcpa_p, image.size - (size_t)image.tcpa);
+	tcpa_p->entries[0].pcr = CBTABLE_PCR_COUNT;
+	tcpa_p->entries[1].digest_length = 48;
+
+	CHECK(cb_tcpa_replay(tcpa_p, count, out, room, fakeExtend, &calls) == 0);
+	CHECK(out->skipped == 2);
+	CHECK(out->count == 16);
+	CHECK(calls == count - 2);
+
+	for (v = 0; v < out->count && v < room; v++) {
+		struct cbtable_pcr_value* value = &out->pcrs[v];
+		UINT8 expect[CBTABLE_PCR_DIGEST_MAX];
+		UINT32 entries = 0;
+
+		if (v)
+			CHECK(value->algorithm > out->pcrs[v - 1].algorithm ||
+				(value->algorithm == out->pcrs[v - 1].algorithm && value->pcr > out->pcrs[v - 1].pcr));
+		CHECK(value->digest_length == cb_pcr_digest_length(value->algorithm));
+
+		memset(expect, 0, sizeof(expect));
+		for (i = 0; i < count; i++) {
+			struct tcpa_entry* entry = &tcpa_p->entries[i];
+
+			if (entry->pcr != value->pcr || entry->digest_length != value->digest_length)
+				continue;
+			for (j = 0; j < value->digest_length; j++)
+				expect[j] = (UINT8)(expect[j] * 31 + entry->digest[j] + value->algorithm);
+			entries++;
+		}
+
+		CHECK(value->entries == entries);
+		CHECK(!memcmp(value->digest, expect, sizeof(expect)));
+	}
+
+	/* too little room hashes nothing, a failing hash stops the replay */
+	calls = 0;
+	CHECK(cb_tcpa_replay(tcpa_p, count, out, 15, fakeExtend, &calls) == CB_REPLAY_NO_ROOM);
+	CHECK(out->count == 16 && calls == 0);
+	CHECK(cb_tcpa_replay(tcpa_p, count, out, room, failingExtend, NULL) == 5);
+
+	free(out);
+	cbimage_free(&image);
+	return failures;
+}
+
+/* lower case hex of a digest */
+static void toHex(const UINT8* digest, size_t len, char* out)
+{
+	size_t i;
+
+	for (i = 0; i < len; i++)
+		sprintf(out + i * 2, "%02x", digest[i]);
+}
+
+/* FIPS 180 vectors, then a replay of a short log with the real hashes */
+static int testPcrHashes(void)
+{
+	static const char* twoBlocks = "abcdbcdecdefdefgefghfghighijhijkijkljklmklmnlmnomnopnopq";
+	struct {
+		struct tcpa_table table;
+		struct tcpa_entry entries[3];
+	} log;
+	struct cbtable_pcr_replay* out = malloc(sizeof(*out) + 4 * sizeof(out->pcrs[0]));
+	UINT8 digest[CBHASH_SHA256_LENGTH];
+	char hex[2 * CBHASH_SHA256_LENGTH + 1];
+	int failures = 0;
+
+	CHECK(out != NULL);
+	if (!out)
+		return failures;
+
+	cbhash_sha1("abc", 3, digest);
+	toHex(digest, CBHASH_SHA1_LENGTH, hex);
+	CHECK(!strcmp(hex, "a9993e364706816aba3e25717850c26c9cd0d89d"));
+	cbhash_sha1(twoBlocks, strlen(twoBlocks), digest);
+	toHex(digest, CBHASH_SHA1_LENGTH, hex);
+	CHECK(!strcmp(hex, "84983e441c3bd26ebaae4aa1f95129e5e54670f1"));
+
+	cbhash_sha256("abc", 3, digest);
+	toHex(digest, CBHASH_SHA256_LENGTH, hex);
+	CHECK(!strcmp(hex, "ba7816bf8f01cfea414140de5dae2223b00361a396177a9cb410ff61f20015ad"));
+	cbhash_sha256(twoBlocks, strlen(twoBlocks), digest);
+	toHex(digest, CBHASH_SHA256_LENGTH, hex);
+	CHECK(!strcmp(hex, "248d6a61d20638b8e5c026930c3e6039a33ce45964ff2167f6ecedd419db06c1"));
+
+	/* PCR 0 extended twice with SHA-1 digests, PCR 2 once with SHA-256 */
+	memset(&log, 0, sizeof(log));
+	log.table.max_entries = 3;
+	log.table.num_entries = 3;
+	log.entries[0].digest_length = CBHASH_SHA1_LENGTH;
+	memset(log.entries[0].digest, 0x11, CBHASH_SHA1_LENGTH);
+	log.entries[1].digest_length = CBHASH_SHA1_LENGTH;
+	memset(log.entries[1].digest, 0x22, CBHASH_SHA1_LENGTH);
+	log.entries[2].pcr = 2;
+	log.entries[2].digest_length = CBHASH_SHA256_LENGTH;
+	memset(log.entries[2].digest, 0x33, CBHASH_SHA256_LENGTH);
+
+	CHECK(cb_tcpa_replay(&log.table, 3, out, 4, cbhash_extend, NULL) == 0);
+	CHECK(out->count == 2 && out->skipped == 0);
+	CHECK(out->pcrs[0].pcr == 0 && out->pcrs[0].entries == 2);
+	toHex(out->pcrs[0].digest, CBHASH_SHA1_LENGTH, hex);
+	CHECK(!strcmp(hex, "46b4464c04c4622cca40e7fa48bb2c729ebc301d"));
+	CHECK(out->pcrs[1].pcr == 2 && out->pcrs[1].entries == 1);
+	toHex(out->pcrs[1].digest, CBHASH_SHA256_LENGTH, hex);
+	CHECK(!strcmp(hex, "aa3fbb7913e12ae041ff4ac2b75384d7e97ab7a9cc3e405c2bbfc96c65590160"));
+
+	CHECK(cbhash_extend(NULL, CBTABLE_PCR_SHA256, digest, digest, CBHASH_SHA1_LENGTH) != 0);
+
+	free(out);
+	return failures;
+}
+
+/* lookup by name, enum text and bit fields of the generated option table */
+static int testOptions(void)
+{
+	static const struct {
+		const char* name;
+		UINT64 value;
+		const char* text;	/* enum text, NULL for a hex option */
+	} expect[] = {
+		{ "boot_delay", 0x2a5b, NULL },		/* bits 405-418, three bytes */
+		{ "boot_option", 1, "Normal" },
+		{ "check_sum", 0xbeef, NULL },
+		{ "debug_level", 7, "Debug" },
+		{ "power_on_after_fail", 1, "Enable" },
+		{ "reboot_counter", 3, NULL },
+		{ "sata_mode", 5, "RAID" },		/* bits 398-400, two bytes */
+	};
+	static const char* missing[] = { "", "boot", "boot_options", "debug_leve", "zzz" };
+	struct cbimage_config config;
+	struct cbimage image;
+	struct coreboot_table_header* hdr;
+	struct cmos_option_table* table = NULL;
+	struct cmos_defaults* defaults = NULL;
+	struct cmos_entries* index[8];
+	struct cmos_entries field;
+	UINT8 bytes[3] = { 0x80, 0xff, 0x01 };
+	UINT32 count = 0, i;
+	UINT64 value;
+	int failures = 0;
+
+	cbimage_defaults(&config);
+	CHECK(!cbimage_build(&config, &image));
+
+	hdr = cb_table_valid(image.data + image.table, image.size - (size_t)image.table);
+	if (hdr)
+		table = CB_ENTRY_VIEW(cb_find_entry(hdr, LB_TAG_CMOS_OPTION_TABLE), struct cmos_option_table);
+	CHECK(table != NULL);
+	if (table) {
+		CHECK(cb_option_count(table) == 7);
+		count = cb_option_index(table, index);
+		defaults = cb_option_defaults(table);
+	}
+	CHECK(count == 7);
+	CHECK(defaults != NULL);
+
+	/* the index is sorted whatever order the table lists the options in */
+	for (i = 1; i < count; i++)
+		CHECK(cb_option_name_cmp(index[i - 1]->name, index[i]->name) < 0);
+
+	for (i = 0; i < sizeof(expect) / sizeof(expect[0]) && count == 7 && defaults; i++) {
+		struct cmos_entries* option = cb_option_find(index, count, (const UINT8*)expect[i].name);
+		struct cmos_enums* option_enum;
+
+		CHECK(option != NULL);
+		if (!option)
+			continue;
+
+		CHECK(!strcmp((const char*)option->name, expect[i].name));
+		CHECK(cb_option_value(defaults->default_set, sizeof(defaults->default_set), option, &value));
+		CHECK(value == expect[i].value);
+
+		CHECK((option->config == 'e') == (expect[i].text != NULL));
+		if (!expect[i].text)
+			continue;
+
+		option_enum = cb_option_enum(table, option->config_id, (UINT32)value);
+		CHECK(option_enum && !strcmp((const char*)option_enum->text, expect[i].text));
+	}
+
+	for (i = 0; i < sizeof(missing) / sizeof(missing[0]); i++)
+		CHECK(cb_option_find(index, count, (const UINT8*)missing[i]) == NULL);
+	CHECK(cb_option_find(index, 0, (const UINT8*)"boot_option") == NULL);
+
+	/* a value with no enum record resolves to nothing */
+	if (table)
+		CHECK(cb_option_enum(table, 2, 5) == NULL);
+
+	/* bits 7-16 take the top bit of byte 0, all of byte 1 and the low bit of byte 2 */
+	memset(&field, 0, sizeof(field));
+	field.bit = 7;
+	field.length = 10;
+	CHECK(cb_option_value(bytes, sizeof(bytes), &field, &value) && value == 0x3ff);
+	bytes[1] = 0x5a;
+	CHECK(cb_option_value(bytes, sizeof(bytes), &field, &value) && value == (1 | 0x5a << 1 | 1 << 9));
+
+	/* a field running past the image, or wider than 64 bits, reads nothing */
+	CHECK(!cb_option_value(bytes, 2, &field, &value) && value == 0);
+	field.length = 65;
+	CHECK(!cb_option_value(bytes, sizeof(bytes), &field, &value));
+
+	cbimage_free(&image);
+	return failures;
+}
+
+static int testMemoryMap(void)
+{
+	struct cbimage_config config;
+	struct cbimage image;
+	struct coreboot_table_header* hdr;
+	struct lb_memory* mem;
+	struct cbtable_memory_range ranges[8];
+	UINT64 addrs[5];
+	UINT32 types[5];
+	UINT32 count = 0;
+	int failures = 0;
+
+	cbimage_defaults(&config);
+	CHECK(!cbimage_build(&config, &image));
+
+	hdr = cb_table_valid(image.data + image.table, image.size - (size_t)image.table);
+	mem = hdr ? CB_ENTRY_VIEW(cb_find_entry(hdr, LB_TAG_MEMORY), struct lb_memory) : NULL;
+	CHECK(mem != NULL);
+	if (mem) {
+		CHECK(cb_memory_range_count(mem) == 4);
+		count = cb_memory_build(mem, ranges);
+	}
+	CHECK(count == 4);
+
+	addrs[0] = 0x1000;
+	addrs[1] = 0xb0000;
+	addrs[2] = 0x180000;
+	addrs[3] = image.console;
+	addrs[4] = image.size;
+	cb_memory_classify_batch(ranges, count, addrs, types, 5);
+	CHECK(types[0] == LB_MEM_RAM);
+	CHECK(types[1] == LB_MEM_RESERVED);
+	CHECK(types[2] == LB_MEM_RAM);
+	CHECK(types[3] == LB_MEM_TABLE);
+	CHECK(types[4] == 0);
+
+	/* spans must lie inside one range */
+	CHECK(cb_memory_span_type(ranges, count, image.console, 0x1000) == LB_MEM_TABLE);
+	CHECK(cb_memory_span_type(ranges, count, image.table, 0x1000) == LB_MEM_TABLE);
+	CHECK(cb_memory_span_type(ranges, count, 0xb0000, 0x10000) == LB_MEM_RESERVED);
+	CHECK(cb_memory_span_type(ranges, count, 0xb0000, 0x100000) == 0);
+	CHECK(cb_memory_span_type(ranges, count, 0x1000, 0) == 0);
+	CHECK(cb_memory_span_type(ranges, count, ~(UINT64)0 - 0xfff, 0x2000) == 0);
+	CHECK(cb_memory_span_type(ranges, count, image.size, 1) == 0);
+
+	cbimage_free(&image);
+	return failures;
+}
+
+/* writes image to a temporary file and opens it as a cbsource */
+static int openImage(struct cbimage* image, struct cbsource* source)
+{
+	char path[] = "/tmp/cbtestXXXXXX";
+	int fd = mkstemp(path);
+	int result = -1;
+
+	if (fd < 0)
+		return -1;
+
+	if (write(fd, image->data, image->size) == (ssize_t)image->size)
+		result = cbsource_open(source, path);
+
+	close(fd);
+	unlink(path);
+	return result;
+}
+
+/* every region of source, read in chunk sized pieces, against image */
+static int checkSourceReads(struct cbimage* image, struct cbsource* source, size_t chunk)
+{
+	static const UINT32 regions[] = { NextRequestConsole, NextRequestTimestamps, NextRequestRoot, NextRequestTcpa };
+	UINT64 addresses[NextRequestReserved];
+	size_t total = 1 << 20;
+	UINT8* expect = malloc(total);
+	UINT8* got = malloc(total);
+	size_t r;
+	int failures = 0;
+
+	CHECK(expect && got);
+	if (!expect || !got) {
+		free(expect);
+		free(got);
+		return failures;
+	}
+
+	addresses[NextRequestConsole] = image->console;
+	addresses[NextRequestTimestamps] = image->timestamps;
+	addresses[NextRequestRoot] = image->table;
+	addresses[NextRequestTcpa] = image->tcpa;
+
+	for (r = 0; r < sizeof(regions) / sizeof(regions[0]); r++) {
+		UINT32 region = regions[r];
+		struct cbsource_region* mapped = &source->regions[region];
+		UINT64 offset = 0;
+		size_t avail, len, n;
+
+		CHECK(mapped->address == addresses[region]);
+		CHECK(mapped->data != NULL);
+		if (!mapped->data)
+			continue;
+
+		/* the root region is the table itself, the others end with the image */
+		avail = image->size - (size_t)addresses[region];
+		if (region == NextRequestRoot) {
+			struct coreboot_table_header* hdr = (struct coreboot_table_header*)(image->data + image->table);
+			avail = (size_t)hdr->header_bytes + hdr->table_bytes;
+		}
+
+		len = cb_region_read(region, image->data + addresses[region], avail, 0, expect, total);
+		CHECK(len > 0 && len < total);
+
+		do {
+			n = cbsource_read(source, region, offset, got + offset, chunk);
+			offset += n;
+		} while (n == chunk);
+
+		CHECK(offset == len);
+		CHECK(!memcmp(expect, got, len));
+	}
+
+	free(expect);
+	free(got);
+	return failures;
+}
+
+static int testSource(void)
+{
+	struct cbimage_config config;
+	struct cbimage image;
+	struct cbsource source;
+	int forward;
+	int failures = 0;
+
+	for (forward = 0; forward < 2; forward++) {
+		cbimage_defaults(&config);
+		config.forward = forward;
+		config.console_wrapped = 1;
+		config.timestamps = 500;
+		config.tcpa = 20;
+		CHECK(!cbimage_build(&config, &image));
+
+		CHECK(!openImage(&image, &source));
+		CHECK(source.low_table == CBIMAGE_LOW_TABLE);
+		failures += checkSourceReads(&image, &source, 1 << 20);
+		failures += checkSourceReads(&image, &source, 4093);
+		CHECK(cbsource_read(&source, NextRequestReserved, 0, image.data, 16) == 0);
+
+		cbsource_close(&source);
+		cbimage_free(&image);
+	}
+
+	return failures;
+}
+
+/* one cbread_request over fd, 0 with *reply filled in, -1 on a socket error */
+static int fetch(int fd, UINT32 region, UINT64 offset, UINT64 length, struct cbread_reply* reply, UINT8* out)
+{
+	struct cbread_request request;
+	UINT64 done = 0;
+
+	memset(&request, 0, sizeof(request));
+	request.region = region;
+	request.offset = offset;
+	request.length = length;
+
+	if (write(fd, &request, sizeof(request)) != sizeof(request) ||
+		recv(fd, reply, sizeof(*reply), MSG_WAITALL) != sizeof(*reply))
+		return -1;
+
+	while (done < reply->length) {
+		ssize_t got = recv(fd, out + done, (size_t)(reply->length - done), 0);
+
+		if (got <= 0)
+			return -1;
+		done += (UINT64)got;
+	}
+	return 0;
+}
+
+static int testServe(void)
+{
+	struct cbimage_config config;
+	struct cbimage image;
+	struct cbsource source;
+	struct cbread_reply reply;
+	UINT8* expect;
+	UINT8* got;
+	size_t len;
+	UINT64 offset = 0;
+	int status = -1;
+	int sv[2];
+	pid_t child;
+	int failures = 0;
+
+	cbimage_defaults(&config);
+	config.console_size = 256 << 10;
+	config.console_wrapped = 1;
+	config.tcpa = 0;
+	CHECK(!cbimage_build(&config, &image));
+	CHECK(!openImage(&image, &source));
+	CHECK(!socketpair(AF_UNIX, SOCK_STREAM, 0, sv));
+
+	child = fork();
+	if (child == 0) {
+		close(sv[0]);
+		_exit(cbsource_serve(&source, sv[1]) ? 1 : 0);
+	}
+	close(sv[1]);
+	CHECK(child > 0);
+
+	expect = malloc(CBREAD_MAX_LENGTH);
+	got = malloc(CBREAD_MAX_LENGTH);
+	CHECK(expect && got);
+
+	if (child > 0 && expect && got) {
+		len = cb_region_read(NextRequestConsole, image.data + image.console, image.size - (size_t)image.console, 0, expect, CBREAD_MAX_LENGTH);
+
+		/* chunked until a short reply, like a ReadFile loop */
+		do {
+			CHECK(!fetch(sv[0], NextRequestConsole, offset, 60000, &reply, got + offset));
+			CHECK(reply.status == CBREAD_OK);
+			offset += reply.length;
+		} while (reply.status == CBREAD_OK && reply.length == 60000);
+		CHECK(offset == len);
+		CHECK(!memcmp(expect, got, len));
+
+		/* lengths past the limit are clamped, not refused */
+		CHECK(!fetch(sv[0], NextRequestConsole, 0, (UINT64)1 << 40, &reply, got));
+		CHECK(reply.status == CBREAD_OK && reply.length == len);
+
+		CHECK(!fetch(sv[0], NextRequestTcpa, 0, 64, &reply, got));
+		CHECK(reply.status == CBREAD_NOT_PRESENT && reply.length == 0);
+		CHECK(!fetch(sv[0], NextRequestReserved, 0, 64, &reply, got));
+		CHECK(reply.status == CBREAD_BAD_REGION && reply.length == 0);
+	}
+
+	close(sv[0]);
+	if (child > 0)
+		waitpid(child, &status, 0);
+	CHECK(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+
+	free(expect);
+	free(got);
+	cbsource_close(&source);
+	cbimage_free(&image);
+	return failures;
+}
+
+int main(void)
+{
+	static const struct {
+		const char* name;
+		int (*run)(void);
+	} tests[] = {
+		{ "checksum", testChecksum },
+		{ "table", testTable },
+		{ "console", testConsole },
+		{ "console stages", testConsoleStages },
+		{ "short buffers", testShortBuffers },
+		{ "regions", testRegions },
+		{ "tcpa replay", testTcpaReplay },
+		{ "pcr hashes", testPcrHashes },
+		{ "memory map", testMemoryMap },
+		{ "options", testOptions },
+		{ "source", testSource },
+		{ "serve", testServe },
+	};
+	int failed = 0;
+	size_t i;
+
+	for (i = 0; i < sizeof(tests) / sizeof(tests[0]); i++) {
+		int failures = tests[i].run();
+
+		printf("%-16s %s\n", tests[i].name, failures ? "FAILED" : "ok");
+		if (failures)
+			failed++;
+	}
+
+	return failed ? 1 : 0;
+}